@@ -0,0 +1,418 @@
+// Measures the hot paths of the library over a grid of layer widths, batch
+// sizes and thread counts and prints the results as JSON.
+//
+//   Benchmark [--json results.json] [--filter name] [--quick]
+//
+// Every result reports samples (or elements) per second, GFLOP/s and the
+// memory bandwidth implied by the bytes each operation must touch.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include "neural_network.h"
+#include "hogwild.h"
+#include "kernels.h"
+#include "random.h"
+
+struct Result
+{
+    std::string name;
+    size_t width;
+    size_t batch;
+    size_t threads;
+    size_t iterations;
+    double seconds;
+    double items_per_second;
+    double gflops;
+    double gbytes_per_second;
+    // Training loss after the run, negative when not measured
+    double loss;
+};
+
+class Benchmark
+{
+public:
+    Benchmark(double min_seconds, std::string filter)
+        : min_seconds(min_seconds), filter(std::move(filter))
+    {}
+
+    // Runs body until min_seconds have passed. items, flops and bytes are
+    // per call of body.
+    void run(const std::string& name, size_t width, size_t batch, size_t threads,
+             double items, double flops, double bytes, const std::function<void()>& body)
+    {
+        if (!enabled(name))
+            return;
+
+        using Clock = std::chrono::steady_clock;
+        body();
+        size_t iterations = 0;
+        size_t round = 1;
+        const auto start = Clock::now();
+        double seconds = 0;
+        while (seconds < min_seconds)
+        {
+            for (size_t i = 0; i < round; ++i)
+                body();
+            iterations += round;
+            round *= 2;
+            seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        const double calls = iterations / seconds;
+        add({ name, width, batch, threads, iterations, seconds, items * calls, flops * calls * 1e-9, bytes * calls * 1e-9, -1 });
+    }
+
+    bool enabled(const std::string& name) const
+    {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    // Adds a result measured by the caller
+    void add(const Result& r)
+    {
+        results.push_back(r);
+        std::cerr << r.name << " width=" << r.width << " batch=" << r.batch << " threads=" << r.threads
+                  << ": " << r.items_per_second << "/s, " << r.gflops << " GFLOP/s, " << r.gbytes_per_second << " GB/s";
+        if (r.loss >= 0)
+            std::cerr << ", loss " << r.loss;
+        std::cerr << '\n';
+    }
+
+    void writeJson(std::ostream& os) const
+    {
+        os << "{\n  \"kernels\": \"" << kernels().name << "\",\n  \"scalar_bytes\": " << sizeof(Scalar) << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            os << "    { \"name\": \"" << r.name << "\", \"width\": " << r.width << ", \"batch\": " << r.batch
+               << ", \"threads\": " << r.threads << ", \"iterations\": " << r.iterations << ", \"seconds\": " << r.seconds
+               << ", \"items_per_second\": " << r.items_per_second << ", \"gflops\": " << r.gflops
+               << ", \"gbytes_per_second\": " << r.gbytes_per_second;
+            if (r.loss >= 0)
+                os << ", \"loss\": " << r.loss;
+            os << " }" << (i + 1 < results.size() ? "," : "") << '\n';
+        }
+        os << "  ]\n}\n";
+    }
+
+private:
+    const double min_seconds;
+    const std::string filter;
+    std::vector<Result> results;
+};
+
+static std::vector<std::vector<Scalar>> randomSamples(size_t count, size_t size)
+{
+    std::vector<std::vector<Scalar>> samples(count, std::vector<Scalar>(size));
+    for (auto& sample : samples)
+        for (auto& value : sample)
+            value = (Scalar)Random::Float();
+    return samples;
+}
+
+// width -> width -> width network, so every measured layer is square
+static void buildNetwork(NeuralNetwork& net, size_t width, size_t threads)
+{
+    net.add(width);
+    net.add<Tanh>(width);
+    net.add<Sigmoid>(width);
+    net.initWeights();
+    net.setOptimizer<Gd>(0.001);
+    net.setThreadCount(threads);
+}
+
+static void benchLayers(Benchmark& bench, size_t width, size_t threads)
+{
+    const double weights = double(width) * width;
+    const double weight_bytes = weights * sizeof(Scalar);
+
+    NeuralNetwork net;
+    buildNetwork(net, width, threads);
+    auto inputs = randomSamples(1, width);
+    auto targets = randomSamples(1, width);
+    net.forward(inputs[0]);
+
+    bench.run("layer_forward", width, 1, threads, 1, 2 * weights, weight_bytes, [&] { net.layers[1].forward(); });
+    // Propagates errors to the previous layer and accumulates weight gradients
+    bench.run("layer_gradients", width, 1, threads, 1, 4 * weights, 3 * weight_bytes, [&] { net.layers[2].calculateGradients(targets[0]); });
+}
+
+static void benchBatches(Benchmark& bench, size_t width, size_t batch, size_t threads)
+{
+    const double weights = 2.0 * width * width;
+    const double weight_bytes = weights * sizeof(Scalar);
+
+    NeuralNetwork net;
+    buildNetwork(net, width, threads);
+    Matrix inputs(batch, width);
+    Matrix targets(batch, width);
+    for (auto& value : inputs.values)
+        value = (Scalar)Random::Float();
+    for (auto& value : targets.values)
+        value = (Scalar)Random::Float();
+
+    bench.run("forward_batch", width, batch, threads, batch, 2 * weights * batch, weight_bytes, [&] { net.forwardBatch(inputs.view()); });
+    net.forwardBatch(inputs.view());
+    bench.run("backward_batch", width, batch, threads, batch, 4 * weights * batch, 3 * weight_bytes, [&] { net.backwardBatch(targets.view()); });
+    bench.run("train_batch", width, batch, threads, batch, 6 * weights * batch, 6 * weight_bytes,
+              [&] { net.trainBatch(inputs.view(), targets.view()); });
+    // Same step with activations and errors stored in bfloat16
+    net.setMixedPrecision(true);
+    bench.run("train_batch_mixed", width, batch, threads, batch, 6 * weights * batch, 6 * weight_bytes,
+              [&] { net.trainBatch(inputs.view(), targets.view()); });
+}
+
+template <typename T, typename... Args>
+static void benchOptimizer(Benchmark& bench, const std::string& name, size_t width, size_t threads,
+                           double flops_per_weight, double arrays, Args... args)
+{
+    NeuralNetwork net;
+    buildNetwork(net, width, threads);
+    net.setOptimizer<T>(args...);
+    size_t parameters = 0;
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+        parameters += net.layers[layer].weights.size() + net.layers[layer].size;
+
+    // Every array is read and written once per step
+    size_t iteration = 0;
+    bench.run(name, width, 1, threads, parameters, flops_per_weight * parameters, 2 * arrays * parameters * sizeof(Scalar),
+              [&] { net.optimize(++iteration); });
+}
+
+static void benchActivations(Benchmark& bench, size_t width)
+{
+    const size_t count = width * width;
+    std::vector<Scalar> x(count);
+    std::vector<Scalar> y(count);
+    for (auto& value : x)
+        value = (Scalar)(Random::Float() * 8 - 4);
+
+    const std::pair<const char*, Activation::Type> activations[] = {
+        { "activation_relu", Activation::Type::RELU },
+        { "activation_sigmoid", Activation::Type::SIGMOID },
+        { "activation_tanh", Activation::Type::TANH },
+        { "activation_swish", Activation::Type::SWISH },
+        { "activation_softplus", Activation::Type::SOFTPLUS },
+        { "activation_softmax", Activation::Type::SOFTMAX }
+    };
+    for (const auto& [name, type] : activations)
+    {
+        auto activation = ActivationFactory::build(type);
+        bench.run(name, width, 1, 1, count, 0, 2.0 * count * sizeof(Scalar), [&]
+        {
+            // Softmax normalizes whole rows, rows are one layer wide
+            for (size_t row = 0; row < width; ++row)
+                activation->apply({ x.data() + row * width, width }, { y.data() + row * width, width });
+        });
+    }
+}
+
+// Dense against block-sparse inference on networks pruned to 80 and 90% sparsity
+static void benchPrunedInference(Benchmark& bench, size_t width, size_t batch)
+{
+    const double weights = 2.0 * width * width;
+    Matrix inputs(batch, width);
+    for (auto& value : inputs.values)
+        value = (Scalar)Random::Float();
+
+    for (int percent : { 80, 90 })
+    {
+        NeuralNetwork net;
+        buildNetwork(net, width, 1);
+        Pruner().prune(net, percent / 100.0);
+        InferenceNetwork frozen = net.freeze();
+        InferenceScratch scratch;
+        const double kept = weights * (1 - percent / 100.0);
+        for (bool sparse : { false, true })
+        {
+            for (size_t layer = 1; layer < frozen.getLayerCount(); ++layer)
+                frozen.setBlockSparse(layer, sparse);
+            const double flops = 2 * (sparse ? kept : weights) * batch;
+            const double bytes = (sparse ? kept : weights) * sizeof(Scalar);
+            const std::string name = std::string(sparse ? "inference_block_sparse" : "inference_dense") + std::to_string(percent);
+            bench.run(name, width, batch, 1, batch, flops, bytes, [&]
+            {
+                if (batch == 1)
+                    frozen.predict({ inputs[0], width }, scratch);
+                else
+                    frozen.predictBatch(inputs.view(), scratch);
+            });
+        }
+    }
+}
+
+static void benchEpoch(Benchmark& bench, size_t width, size_t batch, size_t threads)
+{
+    const size_t samples = 1024;
+    const double weights = 2.0 * width * width;
+
+    NeuralNetwork net;
+    buildNetwork(net, width, threads);
+    net.setBatchSize(batch);
+    auto inputs = randomSamples(samples, width);
+    auto targets = randomSamples(samples, width);
+
+    // Weights are streamed once per mini-batch
+    const double batches = double((samples + batch - 1) / batch);
+    bench.run("epoch", width, batch, threads, samples, 6 * weights * samples, 6 * weights * sizeof(Scalar) * batches,
+              [&] { net.train(inputs, targets, 1); });
+}
+
+// Sparse classification problem: every sample has a few active features,
+// most of them from a block belonging to its class
+struct SparseProblem
+{
+    SparseProblem(size_t sample_count, size_t input_count, size_t active_count, size_t class_count)
+        : inputs(input_count), targets(sample_count, class_count)
+    {
+        const size_t block = input_count / class_count;
+        std::vector<uint32_t> indices;
+        for (size_t sample = 0; sample < sample_count; ++sample)
+        {
+            const size_t label = Random::Uint() % class_count;
+            indices.clear();
+            for (size_t i = 0; i < active_count; ++i)
+                indices.push_back((uint32_t)(Random::Float() < 0.7 ? label * block + Random::Uint() % block : Random::Uint() % input_count));
+            std::sort(indices.begin(), indices.end());
+            indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+            inputs.addRow(indices);
+            targets[sample][label] = 1;
+        }
+    }
+
+    void fill(size_t first, SparseBatch& batch, MatrixView<Scalar> batch_targets) const
+    {
+        batch = inputs.slice(first, batch_targets.rows);
+        std::copy(targets[first], targets[first] + batch_targets.size(), batch_targets.data);
+    }
+
+    double loss(const NeuralNetwork& net) const
+    {
+        Workspace workspace;
+        net.forwardBatch(inputs, workspace);
+        const LayerBatch& outputs = workspace.batches.back();
+        return net.getLoss().evaluateBatch(outputs.neurons.view(), outputs.activated_neurons.view(), targets.view()) / targets.rows;
+    }
+
+    SparseBatch inputs;
+    Matrix targets;
+};
+
+// Synchronous mini-batch training against Hogwild on the same sparse problem
+static void benchSparseTraining(Benchmark& bench, const SparseProblem& problem, size_t threads, size_t epochs)
+{
+    const size_t width = 64;
+    const size_t sync_batch = 32;
+    const size_t samples = problem.targets.rows;
+    auto build = [&](NeuralNetwork& net)
+    {
+        Random::seed = 42;
+        net.add(problem.inputs.cols);
+        net.add<Relu>(width);
+        net.add<Softmax>(problem.targets.cols);
+        net.setLoss<SoftmaxCrossEntropy>();
+        net.initWeights();
+        net.setOptimizer<Gd>(0.05);
+    };
+
+    if (bench.enabled("sparse_sync"))
+    {
+        NeuralNetwork net;
+        build(net);
+        net.setThreadCount(threads);
+        SparseBatch batch;
+        Matrix targets;
+        size_t iteration = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t epoch = 0; epoch < epochs; ++epoch)
+        {
+            for (size_t first = 0; first < samples; first += sync_batch)
+            {
+                targets.resize(std::min(sync_batch, samples - first), problem.targets.cols);
+                problem.fill(first, batch, targets.view());
+                net.trainBatch(batch, targets.view(), ++iteration);
+            }
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        bench.add({ "sparse_sync", width, sync_batch, threads, iteration, seconds, samples * epochs / seconds, 0, 0, problem.loss(net) });
+    }
+
+    if (bench.enabled("sparse_hogwild"))
+    {
+        NeuralNetwork net;
+        build(net);
+        HogwildTrainer trainer(net, threads, 1);
+        trainer.train(samples, [&](size_t first, SparseBatch& batch, MatrixView<Scalar> targets) { problem.fill(first, batch, targets); }, epochs);
+        const auto stats = trainer.getStats();
+        bench.add({ "sparse_hogwild", width, 1, threads, stats.updates, stats.seconds, stats.samples / stats.seconds, 0, 0, problem.loss(net) });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string json_path;
+    std::string filter;
+    bool quick = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg == "--quick")
+            quick = true;
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--json results.json] [--filter name] [--quick]\n";
+            return 1;
+        }
+    }
+
+    const std::vector<size_t> widths = quick ? std::vector<size_t>{ 64, 256 } : std::vector<size_t>{ 64, 256, 1024, 2048 };
+    const std::vector<size_t> batches = quick ? std::vector<size_t>{ 32 } : std::vector<size_t>{ 1, 32, 256 };
+    std::vector<size_t> thread_counts = { 1 };
+    if (std::thread::hardware_concurrency() > 1)
+        thread_counts.push_back(std::thread::hardware_concurrency());
+
+    Benchmark bench(quick ? 0.02 : 0.25, filter);
+    for (size_t width : widths)
+    {
+        benchActivations(bench, width);
+        for (size_t threads : thread_counts)
+        {
+            benchLayers(bench, width, threads);
+            for (size_t batch : batches)
+                benchBatches(bench, width, batch, threads);
+            benchOptimizer<Gd>(bench, "optimizer_gd", width, threads, 2, 2, 0.001);
+            benchOptimizer<Sgd>(bench, "optimizer_sgd", width, threads, 5, 3, 0.001, 0.9);
+            benchOptimizer<Adam>(bench, "optimizer_adam", width, threads, 12, 4, 0.001, 0.9, 0.999);
+            if (threads == 1)
+                for (size_t batch : batches)
+                    benchPrunedInference(bench, width, batch);
+            if (width <= 256)
+                for (size_t batch : batches)
+                    benchEpoch(bench, width, batch, threads);
+        }
+    }
+
+    const SparseProblem problem(quick ? 2048 : 16384, 20000, 20, 10);
+    for (size_t threads : thread_counts)
+        benchSparseTraining(bench, problem, threads, quick ? 2 : 5);
+
+    if (json_path.empty())
+    {
+        bench.writeJson(std::cout);
+    }
+    else
+    {
+        std::ofstream os(json_path);
+        bench.writeJson(os);
+    }
+    return 0;
+}
\ No newline at end of file
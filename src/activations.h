@@ -4,6 +4,10 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <span>
+#include "scalar.h"
+#include "matrix.h"
+#include "kernels.h"
 
 struct Activation
 {
@@ -27,10 +31,50 @@ public:
         : type(type)
     {}
 
-    virtual double operator()(double x) const { return x; }
-    virtual double derivative(double x) const { return 1.0; }
-    virtual std::vector<double> operator()(const std::vector<double>& x) const { return {}; }
-    virtual std::vector<double> derivative(const std::vector<double>& x) const { return {}; }
+    virtual Scalar operator()(Scalar x) const { return x; }
+    virtual Scalar derivative(Scalar x) const { return 1.0; }
+    virtual std::vector<Scalar> operator()(const std::vector<Scalar>& x) const
+    {
+        std::vector<Scalar> y(x.size());
+        apply(x, y);
+        return y;
+    }
+    virtual std::vector<Scalar> derivative(const std::vector<Scalar>& x) const
+    {
+        std::vector<Scalar> y(x.size());
+        applyDerivative(x, y);
+        return y;
+    }
+
+    // Whole-layer versions used by the layers, x and y may alias
+    virtual void apply(std::span<const Scalar> x, std::span<Scalar> y) const
+    {
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = (*this)(x[i]);
+    }
+    virtual void applyDerivative(std::span<const Scalar> x, std::span<Scalar> y) const
+    {
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = derivative(x[i]);
+    }
+    // Turns errors with respect to the outputs y = f(x) into errors with respect to x
+    virtual void backpropagate(std::span<const Scalar> x, std::span<const Scalar>, std::span<Scalar> errors) const
+    {
+        for (size_t i = 0; i < x.size(); ++i)
+            errors[i] *= derivative(x[i]);
+    }
+
+    // Row by row versions for [batch x size] matrices
+    void applyBatch(MatrixView<const Scalar> x, MatrixView<Scalar> y) const
+    {
+        for (size_t row = 0; row < x.rows; ++row)
+            apply({ x[row], x.cols }, { y[row], y.cols });
+    }
+    void backpropagateBatch(MatrixView<const Scalar> x, MatrixView<const Scalar> y, MatrixView<Scalar> errors) const
+    {
+        for (size_t row = 0; row < x.rows; ++row)
+            backpropagate({ x[row], x.cols }, { y[row], y.cols }, { errors[row], errors.cols });
+    }
 
     virtual void save(std::ostream &os) const
     {
@@ -53,33 +97,63 @@ public:
     const Type type;
 };
 
-struct Relu: public Activation
+// Implements the array versions with non-virtual calls to T's scalar
+// functions, so the loops inline and vectorize
+template <typename T>
+struct ElementwiseActivation: public Activation
+{
+    using Activation::Activation;
+
+    void apply(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        const T& self = static_cast<const T&>(*this);
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = self.T::operator()(x[i]);
+    }
+    void applyDerivative(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        const T& self = static_cast<const T&>(*this);
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = self.T::derivative(x[i]);
+    }
+    void backpropagate(std::span<const Scalar> x, std::span<const Scalar>, std::span<Scalar> errors) const override
+    {
+        const T& self = static_cast<const T&>(*this);
+        for (size_t i = 0; i < x.size(); ++i)
+            errors[i] *= self.T::derivative(x[i]);
+    }
+};
+
+// Activations needing a temporary array work through it in chunks that stay in L1
+inline constexpr size_t ACTIVATION_CHUNK = 256;
+
+struct Relu: public ElementwiseActivation<Relu>
 {
     Relu()
-        : Activation(Type::RELU)
+        : ElementwiseActivation(Type::RELU)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
     {
         return x * (x >= 0);
     }
-    double derivative(double x) const override
+    Scalar derivative(Scalar x) const override
     {
         return x >= 0;
     }
 };
 
-struct Lrelu: public Activation
+struct Lrelu: public ElementwiseActivation<Lrelu>
 {
     Lrelu(double scale = 0.01)
-        : scale(scale), Activation(Type::LRELU)
+        : scale(scale), ElementwiseActivation(Type::LRELU)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
     {
         return (x < 0) ? (-scale * x) : x;
     }
-    double derivative(double x) const override
+    Scalar derivative(Scalar x) const override
     {
         return x >= 0 ? 1 : scale;
     }
@@ -97,83 +171,115 @@ public:
     double scale;
 };
 
-struct Sigmoid: public Activation
+struct Sigmoid: public ElementwiseActivation<Sigmoid>
 {
     Sigmoid()
-        : Activation(Type::SIGMOID)
+        : ElementwiseActivation(Type::SIGMOID)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
     {
-        return 1.0 / (1.0 + exp(-x));
+        return 1.0 / (1.0 + std::exp(-x));
     }
-    double derivative(double x) const override
+    Scalar derivative(Scalar x) const override
     {
-        double s = 1.0 / (1.0 + exp(-x));
+        Scalar s = 1.0 / (1.0 + std::exp(-x));
         return s * (1.0 - s);
     }
+
+    void apply(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        kernels().sigmoid(x.data(), y.data(), x.size());
+    }
+    void applyDerivative(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        kernels().sigmoid(x.data(), y.data(), x.size());
+        for (size_t i = 0; i < y.size(); ++i)
+            y[i] *= 1 - y[i];
+    }
+    void backpropagate(std::span<const Scalar>, std::span<const Scalar> y, std::span<Scalar> errors) const override
+    {
+        for (size_t i = 0; i < y.size(); ++i)
+            errors[i] *= y[i] * (1 - y[i]);
+    }
 };
 
-struct Arctan: public Activation
+struct Arctan: public ElementwiseActivation<Arctan>
 {
     Arctan()
-        : Activation(Type::ARCTAN)
+        : ElementwiseActivation(Type::ARCTAN)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
     {
-        return atan(x);
+        return std::atan(x);
     }
-    double derivative(double x) const override
+    Scalar derivative(Scalar x) const override
     {
         return 1.0 / (x * x + 1.0);
     }
 };
 
-struct Tanh: public Activation
+struct Tanh: public ElementwiseActivation<Tanh>
 {
     Tanh()
-        : Activation(Type::TANH)
+        : ElementwiseActivation(Type::TANH)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
     {
-        return tanh(x);
+        return std::tanh(x);
     }
-    double derivative(double x) const override
+    Scalar derivative(Scalar x) const override
     {
-        double t = tanh(x);
+        Scalar t = std::tanh(x);
         return 1.0 - t * t;
     }
+
+    void apply(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        kernels().tanh(x.data(), y.data(), x.size());
+    }
+    void applyDerivative(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        kernels().tanh(x.data(), y.data(), x.size());
+        for (size_t i = 0; i < y.size(); ++i)
+            y[i] = 1 - y[i] * y[i];
+    }
+    void backpropagate(std::span<const Scalar>, std::span<const Scalar> y, std::span<Scalar> errors) const override
+    {
+        for (size_t i = 0; i < y.size(); ++i)
+            errors[i] *= 1 - y[i] * y[i];
+    }
 };
 
-struct Step: public Activation
+struct Step: public ElementwiseActivation<Step>
 {
     Step()
-        : Activation(Type::STEP)
+        : ElementwiseActivation(Type::STEP)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
     {
         return x < 0.0 ? -1.0 : 1.0;
     }
-    double derivative(double x) const override
+    Scalar derivative(Scalar x) const override
     {
         return std::signbit(x);
     }
 };
 
-struct Linear: public Activation
+struct Linear: public ElementwiseActivation<Linear>
 {
     Linear()
-        : Activation(Type::LINEAR)
+        : ElementwiseActivation(Type::LINEAR)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
     {
         return x;
     }
-    double derivative(double x) const override
+    Scalar derivative(Scalar x) const override
     {
         return 1.0;
     }
@@ -185,48 +291,79 @@ struct Softmax: public Activation
         : Activation(Type::SOFTMAX)
     {}
 
-    std::vector<double> operator()(const std::vector<double>& x) const override
+    void apply(std::span<const Scalar> x, std::span<Scalar> y) const override
     {
-        std::vector<double> activations = x;
         // For avoiding overflow
-        double max = *std::max_element(activations.begin(), activations.end());
-        double sum = 0.0;
-        for (auto &x : activations)
-        {
-            x = exp(x - max);
-            sum += x;
-        }
-
+        Scalar max = *std::max_element(x.begin(), x.end());
+        for (size_t i = 0; i < x.size(); ++i)
+            y[i] = x[i] - max;
+        kernels().exp(y.data(), y.data(), y.size());
+
+        Scalar sum = 0.0;
+        for (Scalar value : y)
+            sum += value;
         sum = 1.0 / sum;
-        for (auto &x : activations)
-            x *= sum;
-        return activations;
+        for (auto &value : y)
+            value *= sum;
     }
-    std::vector<double> derivative(const std::vector<double>& x) const override
+    // Diagonal of the Jacobian, backpropagate applies the full Jacobian
+    void applyDerivative(std::span<const Scalar> x, std::span<Scalar> y) const override
     {
-        std::vector<double> y = operator()(x);
-        std::vector<double> derivative(x.size());
-        for (int i = 0; i < x.size(); i++)
-            for (int j = 0; j < x.size(); j++)
-                derivative[i] += y[j] * (i == j ? (1 - y[j]) : -y[i]);
-
-        return derivative;
+        apply(x, y);
+        for (auto &value : y)
+            value *= 1 - value;
+    }
+    // errors = J^T * errors with J = diag(y) - y * y^T, in linear time
+    void backpropagate(std::span<const Scalar>, std::span<const Scalar> y, std::span<Scalar> errors) const override
+    {
+        Scalar weighted_sum = kernels().dot(errors.data(), y.data(), y.size());
+        for (size_t i = 0; i < y.size(); ++i)
+            errors[i] = y[i] * (errors[i] - weighted_sum);
     }
 };
 
-struct Elu: public Activation
+struct Elu: public ElementwiseActivation<Elu>
 {
     Elu(double scale = 0.1f)
-        : scale(scale), Activation(Type::ELU)
+        : scale(scale), ElementwiseActivation(Type::ELU)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
+    {
+        return x >= 0.0 ? x : scale * (std::exp(x) - 1.0);
+    }
+    Scalar derivative(Scalar x) const override
+    {
+        return x >= 0.0 ? 1.0 : scale * std::exp(x);
+    }
+
+    void apply(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        Scalar exps[ACTIVATION_CHUNK];
+        for (size_t begin = 0; begin < x.size(); begin += ACTIVATION_CHUNK)
+        {
+            const size_t count = std::min(ACTIVATION_CHUNK, x.size() - begin);
+            kernels().exp(x.data() + begin, exps, count);
+            for (size_t i = 0; i < count; ++i)
+                y[begin + i] = x[begin + i] >= 0 ? x[begin + i] : Scalar(scale * (exps[i] - 1));
+        }
+    }
+    void applyDerivative(std::span<const Scalar> x, std::span<Scalar> y) const override
     {
-        return x >= 0.0 ? x : scale * (exp(x) - 1.0);
+        Scalar exps[ACTIVATION_CHUNK];
+        for (size_t begin = 0; begin < x.size(); begin += ACTIVATION_CHUNK)
+        {
+            const size_t count = std::min(ACTIVATION_CHUNK, x.size() - begin);
+            kernels().exp(x.data() + begin, exps, count);
+            for (size_t i = 0; i < count; ++i)
+                y[begin + i] = x[begin + i] >= 0 ? 1 : Scalar(scale * exps[i]);
+        }
     }
-    double derivative(double x) const override
+    void backpropagate(std::span<const Scalar> x, std::span<const Scalar> y, std::span<Scalar> errors) const override
     {
-        return x >= 0.0 ? 1.0 : scale * exp(x);
+        // scale * exp(x) == y + scale on the negative side
+        for (size_t i = 0; i < x.size(); ++i)
+            errors[i] *= x[i] >= 0 ? 1 : Scalar(y[i] + scale);
     }
 
     void save(std::ostream &os) const
@@ -242,36 +379,91 @@ public:
     double scale;
 };
 
-struct Swish: public Activation
+struct Swish: public ElementwiseActivation<Swish>
 {
     Swish()
-        : Activation(Type::SWISH)
+        : ElementwiseActivation(Type::SWISH)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
     {
-        return x / (1.0 + exp(-x));
+        return x / (1.0 + std::exp(-x));
     }
-    double derivative(double x) const override
+    Scalar derivative(Scalar x) const override
     {
-        double e = exp(x) + 1.0;
+        Scalar e = std::exp(x) + 1.0;
         return (e - 1.0) * (e + x) / (e * e);
     }
+
+    void apply(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        Scalar sigmoids[ACTIVATION_CHUNK];
+        for (size_t begin = 0; begin < x.size(); begin += ACTIVATION_CHUNK)
+        {
+            const size_t count = std::min(ACTIVATION_CHUNK, x.size() - begin);
+            kernels().sigmoid(x.data() + begin, sigmoids, count);
+            for (size_t i = 0; i < count; ++i)
+                y[begin + i] = x[begin + i] * sigmoids[i];
+        }
+    }
+    void applyDerivative(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        Scalar sigmoids[ACTIVATION_CHUNK];
+        for (size_t begin = 0; begin < x.size(); begin += ACTIVATION_CHUNK)
+        {
+            const size_t count = std::min(ACTIVATION_CHUNK, x.size() - begin);
+            kernels().sigmoid(x.data() + begin, sigmoids, count);
+            for (size_t i = 0; i < count; ++i)
+                y[begin + i] = sigmoids[i] * (1 + x[begin + i] * (1 - sigmoids[i]));
+        }
+    }
+    void backpropagate(std::span<const Scalar> x, std::span<const Scalar> y, std::span<Scalar> errors) const override
+    {
+        // f' = s + f * (1 - s) with s = sigmoid(x)
+        Scalar sigmoids[ACTIVATION_CHUNK];
+        for (size_t begin = 0; begin < x.size(); begin += ACTIVATION_CHUNK)
+        {
+            const size_t count = std::min(ACTIVATION_CHUNK, x.size() - begin);
+            kernels().sigmoid(x.data() + begin, sigmoids, count);
+            for (size_t i = 0; i < count; ++i)
+                errors[begin + i] *= sigmoids[i] + y[begin + i] * (1 - sigmoids[i]);
+        }
+    }
 };
 
-struct Softplus: public Activation
+struct Softplus: public ElementwiseActivation<Softplus>
 {
     Softplus()
-        : Activation(Type::SOFTPLUS)
+        : ElementwiseActivation(Type::SOFTPLUS)
     {}
 
-    double operator()(double x) const override
+    Scalar operator()(Scalar x) const override
+    {
+        return std::log(1.0 + std::exp(x));
+    }
+    Scalar derivative(Scalar x) const override
+    {
+        return 1.0 / (1.0 + std::exp(-x));
+    }
+
+    void apply(std::span<const Scalar> x, std::span<Scalar> y) const override
+    {
+        kernels().softplus(x.data(), y.data(), x.size());
+    }
+    void applyDerivative(std::span<const Scalar> x, std::span<Scalar> y) const override
     {
-        return log(1.0 + exp(x));
+        kernels().sigmoid(x.data(), y.data(), x.size());
     }
-    double derivative(double x) const override
+    void backpropagate(std::span<const Scalar> x, std::span<const Scalar>, std::span<Scalar> errors) const override
     {
-        return 1.0 / (1.0 + exp(-x));
+        Scalar sigmoids[ACTIVATION_CHUNK];
+        for (size_t begin = 0; begin < x.size(); begin += ACTIVATION_CHUNK)
+        {
+            const size_t count = std::min(ACTIVATION_CHUNK, x.size() - begin);
+            kernels().sigmoid(x.data() + begin, sigmoids, count);
+            for (size_t i = 0; i < count; ++i)
+                errors[begin + i] *= sigmoids[i];
+        }
     }
 };
 
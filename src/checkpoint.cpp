@@ -0,0 +1,236 @@
+#include "checkpoint.h"
+#include "neural_network.h"
+#include "checksum.h"
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static constexpr char CHECKPOINT_MAGIC[8] = { 'N', 'N', 'C', 'K', 'P', 'T', '\0', '\0' };
+
+// Tensors in file order
+static std::vector<std::span<Scalar>> checkpointTensors(NeuralNetwork& net, Optimizer& optimizer)
+{
+    std::vector<std::span<Scalar>> tensors;
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+    {
+        Layer& l = net.layers[layer];
+        tensors.emplace_back(l.weights.data(), l.weights.size());
+        tensors.emplace_back(l.biases.data(), l.biases.size());
+    }
+    for (std::span<Scalar> state : optimizer.getState())
+        tensors.push_back(state);
+    return tensors;
+}
+
+Checkpointer::Checkpointer(std::string path)
+    : path(std::move(path))
+{
+}
+
+Checkpointer::~Checkpointer()
+{
+    if (writer.joinable())
+        writer.join();
+}
+
+void Checkpointer::save(const NeuralNetwork& net, uint64_t iteration)
+{
+    const auto start = std::chrono::steady_clock::now();
+    wait();
+    if (!net.optimizer)
+        throw std::logic_error("Checkpoints need an optimizer");
+
+    std::ostringstream os(std::ios::binary);
+    os << *net.optimizer;
+    const std::string settings = os.str();
+    const auto tensors = checkpointTensors(const_cast<NeuralNetwork&>(net), *net.optimizer);
+
+    const size_t layer_count = net.getLayerCount();
+    size_t data_bytes = 0;
+    for (const auto& tensor : tensors)
+        data_bytes += tensor.size_bytes();
+
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = VERSION;
+    header.layer_count = (uint32_t)layer_count;
+    header.precision = SCALAR_PRECISION;
+    header.optimizer_type = net.optimizer->getType();
+    header.flags = net.mixed_precision ? CheckpointHeader::MIXED_PRECISION : 0;
+    header.iteration = iteration;
+    header.tensor_count = tensors.size();
+    header.optimizer_bytes = settings.size();
+    header.data_bytes = data_bytes;
+
+    // Only plain copies while the caller waits, the buffer keeps its
+    // capacity so later saves do not allocate
+    const LossScaler& scaler = net.loss_scaler;
+    const CheckpointLossScaler saved_scaler = { scaler.scale, scaler.growth_factor, scaler.backoff_factor,
+                                                scaler.growth_interval, scaler.good_steps, scaler.skipped_steps };
+    staging.resize(sizeof(header) + layer_count * sizeof(uint64_t) + sizeof(saved_scaler) + settings.size() + data_bytes);
+    char* out = staging.data();
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    for (const auto& layer : net.layers)
+    {
+        const uint64_t size = layer.size;
+        std::memcpy(out, &size, sizeof(size));
+        out += sizeof(size);
+    }
+    std::memcpy(out, &saved_scaler, sizeof(saved_scaler));
+    out += sizeof(saved_scaler);
+    std::memcpy(out, settings.data(), settings.size());
+    out += settings.size();
+    for (const auto& tensor : tensors)
+    {
+        std::memcpy(out, tensor.data(), tensor.size_bytes());
+        out += tensor.size_bytes();
+    }
+
+    stats.bytes = staging.size();
+    stats.write_seconds = 0;
+    writer = std::thread(&Checkpointer::write, this);
+    stats.pause_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Checkpointer::wait()
+{
+    if (writer.joinable())
+        writer.join();
+    if (error)
+        std::rethrow_exception(std::exchange(error, nullptr));
+}
+
+void Checkpointer::write()
+{
+    try
+    {
+        NN_PROFILE_SCOPE("checkpoint_write");
+        const auto start = std::chrono::steady_clock::now();
+        Checksum checksum;
+        checksum.update(staging.data(), offsetof(CheckpointHeader, checksum));
+        checksum.update(staging.data() + sizeof(CheckpointHeader), staging.size() - sizeof(CheckpointHeader));
+        const uint64_t value = checksum.finish();
+        std::memcpy(staging.data() + offsetof(CheckpointHeader, checksum), &value, sizeof(value));
+
+        const std::string temporary = path + ".tmp";
+#ifdef _WIN32
+        {
+            std::ofstream os(temporary, std::ios::binary);
+            if (!os.write(staging.data(), staging.size()) || !os.flush())
+                throw std::runtime_error("Cannot write " + temporary);
+        }
+#else
+        // Synced before the rename, so a crash cannot leave an empty file behind the new name
+        const int handle = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (handle < 0)
+            throw std::runtime_error("Cannot create " + temporary);
+        size_t written = 0;
+        while (written < staging.size())
+        {
+            const ssize_t result = ::write(handle, staging.data() + written, staging.size() - written);
+            if (result < 0)
+                break;
+            written += (size_t)result;
+        }
+        const bool synced = written == staging.size() && fsync(handle) == 0;
+        close(handle);
+        if (!synced)
+            throw std::runtime_error("Cannot write " + temporary);
+#endif
+        std::filesystem::rename(temporary, path);
+        stats.write_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+}
+
+uint64_t Checkpointer::load(NeuralNetwork& net, const std::string& path)
+{
+    const MappedFile file(path);
+    CheckpointHeader header;
+    if (file.size() < sizeof(header))
+        throw std::runtime_error(path + " is not a checkpoint");
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+        throw std::runtime_error(path + " is not a checkpoint");
+    if (header.version < 1 || header.version > VERSION)
+        throw std::runtime_error(path + " has unsupported version " + std::to_string(header.version));
+    if (header.precision != SCALAR_PRECISION)
+        throw std::runtime_error(path + " was saved with another precision");
+    const size_t scaler_bytes = header.version >= 2 ? sizeof(CheckpointLossScaler) : 0;
+    if (file.size() != sizeof(header) + header.layer_count * sizeof(uint64_t) + scaler_bytes + header.optimizer_bytes + header.data_bytes)
+        throw std::runtime_error(path + " is truncated");
+
+    Checksum checksum;
+    checksum.update(file.data(), offsetof(CheckpointHeader, checksum));
+    checksum.update(file.data() + sizeof(header), file.size() - sizeof(header));
+    if (checksum.finish() != header.checksum)
+        throw std::runtime_error(path + " is corrupted");
+
+    const uint8_t* in = file.data() + sizeof(header);
+    if (header.layer_count != net.getLayerCount())
+        throw std::runtime_error(path + " has another number of layers");
+    for (const auto& layer : net.layers)
+    {
+        uint64_t size;
+        std::memcpy(&size, in, sizeof(size));
+        in += sizeof(size);
+        if (size != layer.size)
+            throw std::runtime_error(path + " has other layer sizes");
+    }
+    CheckpointLossScaler saved_scaler = {};
+    if (scaler_bytes)
+    {
+        std::memcpy(&saved_scaler, in, sizeof(saved_scaler));
+        in += sizeof(saved_scaler);
+    }
+
+    // The optimizer is restored into a new one and the file checked against
+    // its state before anything of net is replaced
+    std::shared_ptr<Optimizer> optimizer = OptimizerFactory::build(header.optimizer_type, net);
+    if (!optimizer)
+        throw std::runtime_error(path + " has an unknown optimizer");
+    std::istringstream is(std::string((const char*)in, header.optimizer_bytes), std::ios::binary);
+    is >> *optimizer;
+    in += header.optimizer_bytes;
+    optimizer->build();
+
+    const auto tensors = checkpointTensors(net, *optimizer);
+    size_t data_bytes = 0;
+    for (const auto& tensor : tensors)
+        data_bytes += tensor.size_bytes();
+    if (tensors.size() != header.tensor_count || data_bytes != header.data_bytes)
+        throw std::runtime_error(path + " does not match the optimizer's state");
+
+    for (const auto& tensor : tensors)
+    {
+        std::memcpy(tensor.data(), in, tensor.size_bytes());
+        in += tensor.size_bytes();
+    }
+    net.optimizer = std::move(optimizer);
+    if (scaler_bytes)
+    {
+        LossScaler& scaler = net.loss_scaler;
+        scaler.scale = saved_scaler.scale;
+        scaler.growth_factor = saved_scaler.growth_factor;
+        scaler.backoff_factor = saved_scaler.backoff_factor;
+        scaler.growth_interval = (size_t)saved_scaler.growth_interval;
+        scaler.good_steps = (size_t)saved_scaler.good_steps;
+        scaler.skipped_steps = (size_t)saved_scaler.skipped_steps;
+        net.mixed_precision = header.flags & CheckpointHeader::MIXED_PRECISION;
+    }
+    return header.iteration;
+}
\ No newline at end of file
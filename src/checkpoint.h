@@ -0,0 +1,117 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <exception>
+#include "optimizers.h"
+
+class NeuralNetwork;
+
+// Training checkpoint, everything needed to resume a run exactly:
+//
+//   CheckpointHeader                64 bytes
+//   layer sizes                     uint64_t[layer_count]
+//   loss scaler                     CheckpointLossScaler, since version 2
+//   optimizer settings              optimizer_bytes, as written by operator<<
+//   tensors                         data_bytes, packed in Scalar precision
+//
+// The tensors are every layer's weights and biases followed by the
+// optimizer's state, see Optimizer::getState. The checksum covers the header
+// fields before it and everything after the header.
+struct CheckpointHeader
+{
+    enum Flags: uint8_t
+    {
+        MIXED_PRECISION = 1
+    };
+
+    char magic[8];
+    uint32_t version;
+    uint32_t layer_count;
+    Precision precision;
+    Optimizer::Type optimizer_type;
+    uint8_t flags;
+    uint8_t reserved[5];
+    uint64_t iteration;
+    uint64_t tensor_count;
+    uint64_t optimizer_bytes;
+    uint64_t data_bytes;
+    uint64_t checksum;
+};
+static_assert(sizeof(CheckpointHeader) == 64);
+
+// LossScaler of mixed-precision training, so a resumed run keeps its scale
+// instead of searching for it again from the initial one
+struct CheckpointLossScaler
+{
+    double scale;
+    double growth_factor;
+    double backoff_factor;
+    uint64_t growth_interval;
+    uint64_t good_steps;
+    uint64_t skipped_steps;
+};
+static_assert(sizeof(CheckpointLossScaler) == 48);
+
+// Writes checkpoints without stalling training. save only copies the
+// parameters and optimizer state into a staging buffer, the checksum and
+// the file are done on a background thread. The file is written next to
+// path and renamed over it once complete, so path always holds either the
+// previous or the new checkpoint, never a partial one.
+class Checkpointer
+{
+public:
+    static constexpr uint32_t VERSION = 2;
+
+    struct Stats
+    {
+        // Time save kept the caller waiting, a previous write included
+        double pause_seconds = 0;
+        // Time the background write took, valid once wait returned
+        double write_seconds = 0;
+        size_t bytes = 0;
+    };
+
+    explicit Checkpointer(std::string path);
+    // Waits for a write in progress, its errors are dropped
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    // Snapshots net after the step of the given iteration. Waits for the
+    // previous write first and rethrows its error, if it failed.
+    void save(const NeuralNetwork& net, uint64_t iteration);
+    // Blocks until the last checkpoint is on disk, rethrows its error
+    void wait();
+
+    const std::string& getPath() const
+    {
+        return path;
+    }
+    // Of the last save
+    Stats getStats() const
+    {
+        return stats;
+    }
+
+    // Restores the weights and the optimizer with its state into a network
+    // with the same layer sizes, and the mixed-precision setting with its
+    // loss scaler. Version 1 files have no loss scaler, net keeps its own
+    // then. Returns the iteration to continue after. Throws
+    // std::runtime_error if the file is not a valid checkpoint for net,
+    // leaving net unchanged.
+    static uint64_t load(NeuralNetwork& net, const std::string& path);
+
+private:
+    void write();
+
+private:
+    const std::string path;
+    // The whole file, reused by every save
+    std::vector<char> staging;
+    std::thread writer;
+    std::exception_ptr error;
+    Stats stats;
+};
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Multiply-rotate hash over little-endian 8 byte words, a trailing partial
+// word is zero padded. Bytes may be fed in pieces of any size.
+class Checksum
+{
+public:
+    void update(const void* data, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        while (size && pending_bytes)
+        {
+            pending |= uint64_t(*bytes++) << (8 * pending_bytes);
+            --size;
+            if (++pending_bytes == 8)
+                flush();
+        }
+        for (; size >= 8; size -= 8, bytes += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes, 8);
+            mix(word);
+        }
+        for (; size; --size)
+            pending |= uint64_t(*bytes++) << (8 * pending_bytes++);
+    }
+    uint64_t finish()
+    {
+        if (pending_bytes)
+            flush();
+        return state;
+    }
+
+private:
+    void flush()
+    {
+        mix(pending);
+        pending = 0;
+        pending_bytes = 0;
+    }
+    void mix(uint64_t word)
+    {
+        state = ((state << 5 | state >> 59) ^ word) * 0x517CC1B727220A95ULL;
+    }
+
+private:
+    uint64_t state = 0xCBF29CE484222325ULL;
+    uint64_t pending = 0;
+    size_t pending_bytes = 0;
+};
\ No newline at end of file
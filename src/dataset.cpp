@@ -0,0 +1,216 @@
+#include "dataset.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Cannot open " + path);
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(handle);
+        throw std::runtime_error("Cannot map empty file " + path);
+    }
+    mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(handle);
+    if (!mapping)
+        throw std::runtime_error("Cannot map " + path);
+    bytes = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!bytes)
+    {
+        CloseHandle(mapping);
+        mapping = nullptr;
+        throw std::runtime_error("Cannot map " + path);
+    }
+    length = (size_t)file_size.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Cannot map empty file " + path);
+    }
+    void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own
+    ::close(fd);
+    if (address == MAP_FAILED)
+        throw std::runtime_error("Cannot map " + path);
+    bytes = (const uint8_t*)address;
+    length = (size_t)info.st_size;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+#ifdef _WIN32
+        std::swap(mapping, other.mapping);
+#endif
+    }
+    return *this;
+}
+
+void MappedFile::close()
+{
+    if (!bytes)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(bytes);
+    CloseHandle(mapping);
+    mapping = nullptr;
+#else
+    munmap((void*)bytes, length);
+#endif
+    bytes = nullptr;
+    length = 0;
+}
+
+// IDX stores every header field as a big-endian uint32
+static uint32_t readBigEndian(const uint8_t* bytes)
+{
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+IdxFile::IdxFile(const std::string& path)
+    : file(path)
+{
+    static constexpr uint8_t UNSIGNED_BYTE = 0x08;
+
+    const uint8_t* bytes = file.data();
+    if (file.size() < 4 || bytes[0] != 0 || bytes[1] != 0)
+        throw std::runtime_error(path + " is not an IDX file");
+    if (bytes[2] != UNSIGNED_BYTE)
+        throw std::runtime_error(path + " does not hold unsigned bytes");
+
+    const size_t dimension_count = bytes[3];
+    const size_t header_size = 4 + dimension_count * 4;
+    if (dimension_count == 0 || file.size() < header_size)
+        throw std::runtime_error(path + " has a truncated header");
+
+    dimensions.resize(dimension_count);
+    sample_size = 1;
+    for (size_t i = 0; i < dimension_count; ++i)
+    {
+        dimensions[i] = readBigEndian(bytes + 4 + i * 4);
+        if (!i)
+            continue;
+        // Dimensions of a corrupt header could overflow the products
+        if (dimensions[i] && sample_size > SIZE_MAX / dimensions[i])
+            throw std::runtime_error(path + " is shorter than its header claims");
+        sample_size *= dimensions[i];
+    }
+    if (sample_size && getSampleCount() > (file.size() - header_size) / sample_size)
+        throw std::runtime_error(path + " is shorter than its header claims");
+
+    samples = bytes + header_size;
+}
+
+IdxDataset::IdxDataset(const std::string& inputs_path, const std::string& labels_path, size_t class_count)
+    : inputs(inputs_path), labels(labels_path), class_count(class_count)
+{
+    if (labels.getSampleSize() != 1)
+        throw std::runtime_error(labels_path + " does not hold one label per sample");
+    if (labels.getSampleCount() != inputs.getSampleCount())
+        throw std::runtime_error(inputs_path + " and " + labels_path + " hold a different number of samples");
+    setScale(Scalar(1) / 255);
+}
+
+void IdxDataset::setScale(Scalar scale, Scalar offset)
+{
+    for (size_t byte = 0; byte < byte_values.size(); ++byte)
+        byte_values[byte] = Scalar(byte) * scale + offset;
+}
+
+void IdxDataset::setThreshold(uint8_t threshold)
+{
+    for (size_t byte = 0; byte < byte_values.size(); ++byte)
+        byte_values[byte] = byte >= threshold ? 1 : 0;
+}
+
+void IdxDataset::fillBatch(size_t first, MatrixView<Scalar> inputs, MatrixView<Scalar> targets) const
+{
+    for (size_t row = 0; row < inputs.rows; ++row)
+        fillSample(first + row, inputs[row], targets[row]);
+}
+
+void IdxDataset::fillBatch(std::span<const size_t> samples, MatrixView<Scalar> inputs, MatrixView<Scalar> targets) const
+{
+    for (size_t row = 0; row < samples.size(); ++row)
+        fillSample(samples[row], inputs[row], targets[row]);
+}
+
+void IdxDataset::fillSparse(size_t first, SparseBatch& inputs, MatrixView<Scalar> targets) const
+{
+    const bool binary = std::all_of(byte_values.begin(), byte_values.end(), [](Scalar value) { return value == 0 || value == 1; });
+    inputs.cols = getInputSize();
+    inputs.clear();
+    std::vector<uint32_t> indices;
+    std::vector<Scalar> values;
+    for (size_t row = 0; row < targets.rows; ++row)
+    {
+        indices.clear();
+        values.clear();
+        const auto sample = getInput(first + row);
+        for (size_t input = 0; input < sample.size(); ++input)
+        {
+            const Scalar value = byte_values[sample[input]];
+            if (value != 0)
+            {
+                indices.push_back((uint32_t)input);
+                if (!binary)
+                    values.push_back(value);
+            }
+        }
+        inputs.addRow(indices, values);
+        fillTarget(first + row, targets[row]);
+    }
+}
+
+void IdxDataset::fillSample(size_t sample, Scalar* input, Scalar* target) const
+{
+    for (uint8_t byte : inputs[sample])
+        *input++ = byte_values[byte];
+    fillTarget(sample, target);
+}
+
+void IdxDataset::fillTarget(size_t sample, Scalar* target) const
+{
+    std::fill(target, target + class_count, Scalar(0));
+    const uint8_t label = getLabel(sample);
+    if (label >= class_count)
+        throw std::runtime_error("Sample " + std::to_string(sample) + " has label " + std::to_string(label) + ", not below " + std::to_string(class_count));
+    target[label] = 1;
+}
\ No newline at end of file
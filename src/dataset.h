@@ -0,0 +1,139 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <span>
+#include "matrix.h"
+#include "sparse.h"
+
+// Read-only memory mapping of a whole file. Pages are loaded by the OS on
+// first access, so files larger than RAM can be mapped.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    // Throws std::runtime_error when the file cannot be opened or mapped
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const
+    {
+        return bytes;
+    }
+    size_t size() const
+    {
+        return length;
+    }
+
+private:
+    void close();
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
+
+// Memory-mapped IDX file as used by MNIST: a big-endian header with the
+// magic number 0x000008NN (unsigned bytes, NN dimensions) and the dimension
+// sizes, followed by the raw samples. Samples are exposed as views into the
+// mapping without copying.
+class IdxFile
+{
+public:
+    IdxFile() = default;
+    // Throws std::runtime_error on a bad magic number, an unsupported element
+    // type or a file shorter than its header claims
+    explicit IdxFile(const std::string& path);
+
+    // The first dimension counts samples, the others make up one sample
+    size_t getSampleCount() const
+    {
+        return dimensions.empty() ? 0 : dimensions.front();
+    }
+    size_t getSampleSize() const
+    {
+        return sample_size;
+    }
+    const std::vector<uint32_t>& getDimensions() const
+    {
+        return dimensions;
+    }
+
+    std::span<const uint8_t> operator[](size_t sample) const
+    {
+        return { samples + sample * sample_size, sample_size };
+    }
+
+private:
+    MappedFile file;
+    std::vector<uint32_t> dimensions;
+    const uint8_t* samples = nullptr;
+    size_t sample_size = 0;
+};
+
+// Classification dataset of an IDX image file and an IDX label file. Bytes
+// stay in the mapping and are converted to Scalar only when a batch is filled.
+class IdxDataset
+{
+public:
+    IdxDataset(const std::string& inputs_path, const std::string& labels_path, size_t class_count = 10);
+
+    size_t size() const
+    {
+        return inputs.getSampleCount();
+    }
+    size_t getInputSize() const
+    {
+        return inputs.getSampleSize();
+    }
+    size_t getClassCount() const
+    {
+        return class_count;
+    }
+
+    std::span<const uint8_t> getInput(size_t sample) const
+    {
+        return inputs[sample];
+    }
+    uint8_t getLabel(size_t sample) const
+    {
+        return labels[sample][0];
+    }
+
+    // Inputs become byte * scale + offset, 1/255 and 0 by default
+    void setScale(Scalar scale, Scalar offset = 0);
+    // Inputs become 1 for bytes >= threshold and 0 otherwise
+    void setThreshold(uint8_t threshold);
+
+    // Writes samples first .. first + inputs.rows into the rows of inputs
+    // and their one-hot labels into targets
+    void fillBatch(size_t first, MatrixView<Scalar> inputs, MatrixView<Scalar> targets) const;
+    // Same for an arbitrary selection of samples
+    void fillBatch(std::span<const size_t> samples, MatrixView<Scalar> inputs, MatrixView<Scalar> targets) const;
+
+    // Replaces inputs with samples first .. first + targets.rows as sparse
+    // rows, bytes converting to 0 are left out. Thresholded inputs give a
+    // binary batch.
+    void fillSparse(size_t first, SparseBatch& inputs, MatrixView<Scalar> targets) const;
+
+private:
+    void fillSample(size_t sample, Scalar* input, Scalar* target) const;
+    // Throws std::runtime_error for a label that is not below the class count
+    void fillTarget(size_t sample, Scalar* target) const;
+
+private:
+    IdxFile inputs;
+    IdxFile labels;
+    size_t class_count;
+    // Converted value of every byte, so normalizing is a table lookup
+    std::array<Scalar, 256> byte_values;
+};
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "gemm.h"
+#include "kernels.h"
+
+// Tile sizes keep a block of b (or c for gemmTN) resident in L2 while
+// every row of the batch streams past it
+static constexpr size_t BLOCK_ROWS = 64;
+static constexpr size_t BLOCK_DEPTH = 256;
+static constexpr size_t BLOCK_COLS = 512;
+
+// Products smaller than this many multiply-adds stay on the calling thread
+static constexpr size_t PARALLEL_MIN_WORK = 1 << 16;
+
+static size_t blockCount(size_t size, size_t block)
+{
+    return (size + block - 1) / block;
+}
+
+static ThreadPool* poolFor(ThreadPool* pool, size_t m, size_t n, size_t k)
+{
+    return m * n * k >= PARALLEL_MIN_WORK ? pool : nullptr;
+}
+
+// Columns first .. first + count of every row of a matrix. Scalar matrices
+// are read in place, bfloat16 ones are widened into buffer once per panel
+// rather than once per tile.
+struct Panel
+{
+    const Scalar* operator[](size_t row) const
+    {
+        return data + row * stride;
+    }
+
+    const Scalar* data;
+    size_t stride;
+};
+
+static Panel panel(MatrixView<const Scalar> m, size_t first, size_t, AlignedVector<Scalar>&)
+{
+    return { m.data + first, m.cols };
+}
+static Panel panel(MatrixView<const BFloat16> m, size_t first, size_t count, AlignedVector<Scalar>& buffer)
+{
+    buffer.resize(m.rows * count);
+    for (size_t row = 0; row < m.rows; ++row)
+        toScalar(m[row] + first, buffer.data() + row * count, count);
+    return { buffer.data(), count };
+}
+
+static Scalar widen(Scalar value)
+{
+    return value;
+}
+static Scalar widen(BFloat16 value)
+{
+    return toScalar(value);
+}
+
+template <typename A>
+static void gemmNTBlocked(MatrixView<const A> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    const Kernels& kern = kernels();
+    // Tiles of c columns are independent, so they are split across threads
+    parallelFor(poolFor(pool, a.rows, b.rows, a.cols), blockCount(b.rows, BLOCK_ROWS), 1, [&](size_t first_block, size_t last_block)
+    {
+        AlignedVector<Scalar> buffer;
+        for (size_t k0 = 0; k0 < a.cols; k0 += BLOCK_DEPTH)
+        {
+            const size_t k1 = std::min(k0 + BLOCK_DEPTH, a.cols);
+            const Panel a_panel = panel(a, k0, k1 - k0, buffer);
+            for (size_t j0 = first_block * BLOCK_ROWS; j0 < std::min(last_block * BLOCK_ROWS, b.rows); j0 += BLOCK_ROWS)
+            {
+                const size_t j1 = std::min(j0 + BLOCK_ROWS, b.rows);
+                for (size_t i = 0; i < a.rows; ++i)
+                {
+                    const Scalar* a_row = a_panel[i];
+                    Scalar* c_row = c[i];
+                    for (size_t j = j0; j < j1; ++j)
+                        c_row[j] += kern.dot(a_row, b[j] + k0, k1 - k0);
+                }
+            }
+        }
+    });
+}
+
+template <typename A>
+static void gemmNNBlocked(MatrixView<const A> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    const Kernels& kern = kernels();
+    parallelFor(poolFor(pool, a.rows, b.cols, b.rows), blockCount(b.cols, BLOCK_COLS), 1, [&](size_t first_block, size_t last_block)
+    {
+        const size_t cols_end = std::min(last_block * BLOCK_COLS, b.cols);
+        for (size_t k0 = 0; k0 < b.rows; k0 += BLOCK_DEPTH)
+        {
+            const size_t k1 = std::min(k0 + BLOCK_DEPTH, b.rows);
+            for (size_t j0 = first_block * BLOCK_COLS; j0 < cols_end; j0 += BLOCK_COLS)
+            {
+                const size_t j1 = std::min(j0 + BLOCK_COLS, b.cols);
+                for (size_t i = 0; i < a.rows; ++i)
+                {
+                    const A* a_row = a[i];
+                    Scalar* c_row = c[i];
+                    for (size_t k = k0; k < k1; ++k)
+                        kern.axpy(widen(a_row[k]), b[k] + j0, c_row + j0, j1 - j0);
+                }
+            }
+        }
+    });
+}
+
+template <typename A, typename B>
+static void gemmTNBlocked(MatrixView<const A> a, MatrixView<const B> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    const Kernels& kern = kernels();
+    parallelFor(poolFor(pool, a.cols, b.cols, a.rows), blockCount(a.cols, BLOCK_ROWS), 1, [&](size_t first_block, size_t last_block)
+    {
+        AlignedVector<Scalar> buffer;
+        for (size_t j0 = 0; j0 < b.cols; j0 += BLOCK_COLS)
+        {
+            const size_t j1 = std::min(j0 + BLOCK_COLS, b.cols);
+            const Panel b_panel = panel(b, j0, j1 - j0, buffer);
+            for (size_t m0 = first_block * BLOCK_ROWS; m0 < std::min(last_block * BLOCK_ROWS, a.cols); m0 += BLOCK_ROWS)
+            {
+                const size_t m1 = std::min(m0 + BLOCK_ROWS, a.cols);
+                for (size_t k = 0; k < a.rows; ++k)
+                {
+                    const A* a_row = a[k];
+                    const Scalar* b_row = b_panel[k];
+                    for (size_t m = m0; m < m1; ++m)
+                        kern.axpy(widen(a_row[m]), b_row, c[m] + j0, j1 - j0);
+                }
+            }
+        }
+    });
+}
+
+void gemmNT(MatrixView<const Scalar> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    gemmNTBlocked(a, b, c, pool);
+}
+
+void gemmNN(MatrixView<const Scalar> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    gemmNNBlocked(a, b, c, pool);
+}
+
+void gemmTN(MatrixView<const Scalar> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    gemmTNBlocked(a, b, c, pool);
+}
+
+void gemmNT(MatrixView<const BFloat16> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    gemmNTBlocked(a, b, c, pool);
+}
+
+void gemmNN(MatrixView<const BFloat16> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    gemmNNBlocked(a, b, c, pool);
+}
+
+void gemmTN(MatrixView<const BFloat16> a, MatrixView<const BFloat16> b, MatrixView<Scalar> c, ThreadPool* pool)
+{
+    gemmTNBlocked(a, b, c, pool);
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "matrix.h"
+#include "thread_pool.h"
+#include "mixed_precision.h"
+
+// Cache-blocked matrix products used by the batched layer passes.
+// All of them accumulate into c, callers clear or seed it beforehand. With
+// a pool, independent tiles of c are computed on separate threads.
+
+// c += a * b^T, a: [m x k], b: [n x k], c: [m x n]
+void gemmNT(MatrixView<const Scalar> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool = nullptr);
+
+// c += a * b, a: [m x k], b: [k x n], c: [m x n]
+void gemmNN(MatrixView<const Scalar> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool = nullptr);
+
+// c += a^T * b, a: [k x m], b: [k x n], c: [m x n]
+void gemmTN(MatrixView<const Scalar> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool = nullptr);
+
+// Same with operands stored in bfloat16 by mixed-precision training. They are
+// widened a block at a time, the products and c stay in Scalar.
+void gemmNT(MatrixView<const BFloat16> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool = nullptr);
+void gemmNN(MatrixView<const BFloat16> a, MatrixView<const Scalar> b, MatrixView<Scalar> c, ThreadPool* pool = nullptr);
+void gemmTN(MatrixView<const BFloat16> a, MatrixView<const BFloat16> b, MatrixView<Scalar> c, ThreadPool* pool = nullptr);
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "hogwild.h"
+#include "kernels.h"
+#include <chrono>
+#include <stdexcept>
+#include <exception>
+#include <utility>
+#include <mutex>
+
+HogwildTrainer::HogwildTrainer(NeuralNetwork& net, size_t thread_count, size_t batch_size)
+    : net(net), thread_count(std::max<size_t>(1, thread_count)), batch_size(std::max<size_t>(1, batch_size))
+{
+}
+
+void HogwildTrainer::train(size_t sample_count, const NeuralNetwork::BatchFiller& fill, size_t epochs)
+{
+    run(sample_count, epochs, [&](Workspace& workspace, size_t begin, size_t end)
+    {
+        for (size_t first = begin; first < end; first += batch_size)
+        {
+            const size_t count = std::min(batch_size, end - first);
+            workspace.input_batch.resize(count, net.getInputCount());
+            workspace.target_batch.resize(count, net.getOutputCount());
+            fill(first, workspace.input_batch.view(), workspace.target_batch.view());
+            net.forwardBatch(workspace.input_batch.view(), workspace);
+            net.backwardBatch(workspace.target_batch.view(), workspace);
+            apply(workspace, nullptr);
+        }
+    });
+}
+
+void HogwildTrainer::train(size_t sample_count, const SparseFiller& fill, size_t epochs)
+{
+    run(sample_count, epochs, [&](Workspace& workspace, size_t begin, size_t end)
+    {
+        SparseBatch inputs(net.getInputCount());
+        for (size_t first = begin; first < end; first += batch_size)
+        {
+            const size_t count = std::min(batch_size, end - first);
+            workspace.target_batch.resize(count, net.getOutputCount());
+            fill(first, inputs, workspace.target_batch.view());
+            net.forwardBatch(inputs, workspace);
+            net.backwardBatch(inputs, workspace.target_batch.view(), workspace);
+            const Optimizer::ColumnRuns runs = Optimizer::columnRuns(inputs.activeColumns());
+            apply(workspace, &runs);
+        }
+    });
+}
+
+void HogwildTrainer::run(size_t sample_count, size_t epochs, const std::function<void(Workspace&, size_t begin, size_t end)>& worker)
+{
+    if (!net.optimizer || net.optimizer->getType() == Optimizer::Type::ADAM)
+        throw std::invalid_argument("Hogwild training needs a Gd or Sgd optimizer");
+    if (net.reducer)
+        throw std::invalid_argument("Hogwild training cannot reduce gradients over processes");
+    if (net.pruner)
+        net.pruner->buildMasks(net);
+
+    const size_t threads = std::max<size_t>(1, std::min(thread_count, sample_count));
+    std::vector<Workspace> workspaces(threads);
+    // Gradients start cleared and every update clears them again
+    for (auto& workspace : workspaces)
+        net.prepareGradients(workspace);
+
+    // Each thread trains on its own, splitting its layers over the network's
+    // pool would only make the threads wait for each other
+    const std::shared_ptr<ThreadPool> pool = std::exchange(net.pool, nullptr);
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t thread = 0; thread < threads; ++thread)
+    {
+        workers.emplace_back([&, thread]
+        {
+            try
+            {
+                for (size_t epoch = 0; epoch < epochs; ++epoch)
+                    worker(workspaces[thread], sample_count * thread / threads, sample_count * (thread + 1) / threads);
+            }
+            catch (...)
+            {
+                std::lock_guard lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        });
+    }
+    for (auto& thread : workers)
+        thread.join();
+    net.pool = pool;
+
+    stats.samples = sample_count * epochs;
+    stats.updates = 0;
+    for (size_t thread = 0; thread < threads; ++thread)
+    {
+        const size_t shard = sample_count * (thread + 1) / threads - sample_count * thread / threads;
+        stats.updates += (shard + batch_size - 1) / batch_size * epochs;
+    }
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void HogwildTrainer::apply(Workspace& workspace, const Optimizer::ColumnRuns* first_layer_runs)
+{
+    const Kernels& kern = kernels();
+    const Scalar learning_rate = (Scalar)net.optimizer->getLearningRate();
+    Sgd* sgd = net.optimizer->getType() == Optimizer::Type::SGD ? static_cast<Sgd*>(net.optimizer.get()) : nullptr;
+
+    // Plain loads and stores on the shared parameters, no atomics
+    auto update = [&](Scalar* values, Scalar* velocities, Scalar* deltas, size_t count)
+    {
+        if (sgd)
+            kern.sgd(values, velocities, deltas, learning_rate, (Scalar)sgd->momentum, count);
+        else
+            kern.gd(values, deltas, learning_rate, count);
+    };
+
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+    {
+        Layer& l = net.layers[layer];
+        Scalar* velocities = sgd ? sgd->weight_velocities[layer - 1].data() : nullptr;
+        Scalar* deltas = workspace.delta_weights[layer].data();
+        if (layer == 1 && first_layer_runs)
+        {
+            for (size_t neuron = 0; neuron < l.size; ++neuron)
+            {
+                for (const auto& [column, count] : *first_layer_runs)
+                {
+                    const size_t offset = neuron * l.input_size + column;
+                    update(l.weights.data() + offset, velocities ? velocities + offset : nullptr, deltas + offset, count);
+                }
+            }
+        }
+        else
+        {
+            update(l.weights.data(), velocities, deltas, l.weights.size());
+        }
+        update(l.biases.data(), sgd ? sgd->bias_velocities[layer - 1].data() : nullptr, workspace.delta_biases[layer].data(), l.size);
+    }
+    // Another thread's step may land after these zeroes, but its own
+    // masking follows, so pruned weights are zero once all threads are done
+    if (net.pruner)
+        net.pruner->applyMasks(net, first_layer_runs);
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include "neural_network.h"
+
+// Asynchronous lock-free training after Hogwild! (Niu et al., 2011). Every
+// thread trains on its own shard of the samples, computing mini-batch
+// gradients against the shared weights as they are at that moment and
+// applying its Gd or Sgd step straight to them. There are no locks and no
+// barriers, so updates of different threads interleave and may overwrite
+// each other. This is racy by design: sparse problems, where threads rarely
+// touch the same weights, converge about as well as with synchronous
+// training while every core stays busy.
+//
+// The step uses the network's optimizer, which must be Gd or Sgd. Sgd
+// velocities are shared the same way as the weights. A pruner's masks are
+// applied after every update, its schedule only advances in
+// NeuralNetwork::optimize.
+class HogwildTrainer
+{
+public:
+    // Fills the rows of targets and the sparse inputs with the samples starting at first
+    using SparseFiller = std::function<void(size_t first, SparseBatch& inputs, MatrixView<Scalar> targets)>;
+
+    struct Stats
+    {
+        size_t samples = 0;
+        size_t updates = 0;
+        double seconds = 0;
+    };
+
+    // batch_size samples make one update, 1 gives the classic per-sample Hogwild
+    HogwildTrainer(NeuralNetwork& net, size_t thread_count = std::thread::hardware_concurrency(), size_t batch_size = 1);
+
+    // Every thread makes epochs passes over its contiguous shard of the
+    // samples, without waiting for the others between epochs
+    void train(size_t sample_count, const NeuralNetwork::BatchFiller& fill, size_t epochs = 1);
+    // Sparse inputs only update the first layer's weights of active inputs
+    void train(size_t sample_count, const SparseFiller& fill, size_t epochs = 1);
+
+    // Totals of the last train call
+    Stats getStats() const
+    {
+        return stats;
+    }
+
+private:
+    // Runs worker(thread, begin, end) on one thread per shard
+    void run(size_t sample_count, size_t epochs, const std::function<void(Workspace&, size_t begin, size_t end)>& worker);
+    // Applies the gradients in the workspace to the shared parameters and
+    // clears them, for the first layer only in the given column runs
+    void apply(Workspace& workspace, const Optimizer::ColumnRuns* first_layer_runs);
+
+private:
+    NeuralNetwork& net;
+    const size_t thread_count;
+    const size_t batch_size;
+    Stats stats;
+};
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "inference.h"
+#include "neural_network.h"
+#include "kernels.h"
+#include "gemm.h"
+#include "model_file.h"
+
+InferenceNetwork::InferenceNetwork(const NeuralNetwork& net)
+    : input_count(net.getInputCount())
+{
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+    {
+        const Layer& l = net.layers[layer];
+        const Scalar* weights = own(AlignedVector<Scalar>(l.weights.values));
+        const Scalar* biases = own(AlignedVector<Scalar>(l.biases));
+        layers.push_back({ { weights, l.size, l.input_size }, { biases, l.size }, l.activation, nullptr });
+    }
+    allocateBuffers();
+    selectKernels();
+}
+
+InferenceNetwork::InferenceNetwork(NeuralNetwork&& net)
+    : input_count(net.getInputCount())
+{
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+    {
+        Layer& l = net.layers[layer];
+        const Scalar* weights = own(std::move(l.weights.values));
+        const Scalar* biases = own(std::move(l.biases));
+        layers.push_back({ { weights, l.size, l.input_size }, { biases, l.size }, std::move(l.activation), nullptr });
+    }
+    allocateBuffers();
+    selectKernels();
+}
+
+InferenceNetwork::InferenceNetwork(std::shared_ptr<const ModelFile> model)
+    : model(model), input_count(model->getLayerCount() ? model->getLayer(0).size : 0)
+{
+    for (size_t layer = 1; layer < model->getLayerCount(); ++layer)
+    {
+        const LayerRecord& record = model->getLayer(layer);
+        const Scalar* weights;
+        const Scalar* biases;
+        if (model->isMappable())
+        {
+            weights = model->getWeights(layer);
+            biases = model->getBiases(layer);
+        }
+        else
+        {
+            AlignedVector<Scalar> weight_values(record.size * record.input_size);
+            AlignedVector<Scalar> bias_values(record.size);
+            model->readTensor(record.weights_offset, weight_values.data(), weight_values.size());
+            model->readTensor(record.biases_offset, bias_values.data(), bias_values.size());
+            weights = own(std::move(weight_values));
+            biases = own(std::move(bias_values));
+        }
+        layers.push_back({ { weights, record.size, record.input_size }, { biases, record.size }, model->buildActivation(layer), nullptr });
+    }
+    allocateBuffers();
+    selectKernels();
+}
+
+const Scalar* InferenceNetwork::own(AlignedVector<Scalar>&& values)
+{
+    // Moving a vector keeps its buffer, so views stay valid as storage grows
+    storage.push_back(std::move(values));
+    return storage.back().data();
+}
+
+void InferenceNetwork::selectKernels()
+{
+    for (size_t layer = 1; layer < getLayerCount(); ++layer)
+    {
+        auto sparse = std::make_unique<BlockSparseMatrix>(BlockSparseMatrix::fromDense(layers[layer - 1].weights));
+        if (sparse->density() <= SPARSE_MAX_DENSITY)
+            layers[layer - 1].sparse = std::move(sparse);
+    }
+}
+
+void InferenceNetwork::setBlockSparse(size_t layer, bool enabled)
+{
+    FrozenLayer& frozen = layers[layer - 1];
+    if (!enabled)
+        frozen.sparse = nullptr;
+    else if (!frozen.sparse)
+        frozen.sparse = std::make_unique<BlockSparseMatrix>(BlockSparseMatrix::fromDense(frozen.weights));
+}
+
+double InferenceNetwork::getBlockDensity(size_t layer) const
+{
+    const FrozenLayer& frozen = layers[layer - 1];
+    return frozen.sparse ? frozen.sparse->density() : BlockSparseMatrix::fromDense(frozen.weights).density();
+}
+
+void InferenceNetwork::allocateBuffers()
+{
+    widest = input_count;
+    for (const auto& layer : layers)
+        widest = std::max(widest, layer.weights.rows);
+    reserve(scratch, 1);
+}
+
+void InferenceNetwork::reserve(InferenceScratch& scratch, size_t batch_size) const
+{
+    for (auto& buffer : scratch.buffers)
+        if (buffer.size() < batch_size * widest)
+            buffer.resize(batch_size * widest);
+}
+
+std::span<const Scalar> InferenceNetwork::forward(std::span<const Scalar> inputs)
+{
+    return predict(inputs, scratch);
+}
+
+std::span<const Scalar> InferenceNetwork::predict(std::span<const Scalar> inputs, InferenceScratch& scratch) const
+{
+    const Kernels& kern = kernels();
+    reserve(scratch, 1);
+    std::copy(inputs.begin(), inputs.end(), scratch.buffers[0].begin());
+
+    // Each layer reads the buffer the previous one wrote and applies its
+    // activation in place in the other one
+    size_t current = 0;
+    for (const auto& layer : layers)
+    {
+        const Scalar* in = scratch.buffers[current].data();
+        Scalar* out = scratch.buffers[current ^ 1].data();
+        const size_t size = layer.weights.rows;
+        if (layer.sparse)
+        {
+            std::copy(layer.biases.begin(), layer.biases.end(), out);
+            layer.sparse->multiplyAdd(in, out);
+        }
+        else
+        {
+            for (size_t neuron = 0; neuron < size; ++neuron)
+                out[neuron] = layer.biases[neuron] + kern.dot(layer.weights[neuron], in, layer.weights.cols);
+        }
+        layer.activation->apply({ out, size }, { out, size });
+        current ^= 1;
+    }
+    return { scratch.buffers[current].data(), getOutputCount() };
+}
+
+std::span<const Scalar> InferenceNetwork::predict(std::span<const Scalar> inputs) const
+{
+    thread_local InferenceScratch thread_scratch;
+    return predict(inputs, thread_scratch);
+}
+
+MatrixView<const Scalar> InferenceNetwork::predictBatch(MatrixView<const Scalar> inputs, InferenceScratch& scratch) const
+{
+    reserve(scratch, inputs.rows);
+    std::copy(inputs.data, inputs.data + inputs.size(), scratch.buffers[0].begin());
+
+    // Same ping-pong as predict with every buffer viewed as [batch x layer size]
+    size_t current = 0;
+    for (const auto& layer : layers)
+    {
+        MatrixView<const Scalar> in(scratch.buffers[current].data(), inputs.rows, layer.weights.cols);
+        MatrixView<Scalar> out(scratch.buffers[current ^ 1].data(), inputs.rows, layer.weights.rows);
+        for (size_t sample = 0; sample < out.rows; ++sample)
+            std::copy(layer.biases.begin(), layer.biases.end(), out[sample]);
+        if (layer.sparse)
+            layer.sparse->multiplyAdd(in, out);
+        else
+            gemmNT(in, layer.weights, out);
+        layer.activation->applyBatch(out, out);
+        current ^= 1;
+    }
+    return { scratch.buffers[current].data(), inputs.rows, getOutputCount() };
+}
+
+size_t InferenceNetwork::getMemoryUsage() const
+{
+    size_t scalars = scratch.buffers[0].size() + scratch.buffers[1].size();
+    size_t bytes = 0;
+    for (const auto& layer : layers)
+    {
+        scalars += layer.weights.size() + layer.biases.size();
+        if (layer.sparse)
+            bytes += layer.sparse->getMemoryUsage();
+    }
+    return scalars * sizeof(Scalar) + bytes;
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <span>
+#include "activations.h"
+#include "matrix.h"
+#include "sparse.h"
+
+class NeuralNetwork;
+class ModelFile;
+
+// Activation buffers of one caller. Reusing a scratch across calls avoids
+// allocations once it has grown to the largest batch.
+struct InferenceScratch
+{
+    AlignedVector<Scalar> buffers[2];
+};
+
+// Immutable prediction-only form of a trained network. It keeps weights,
+// biases and activations but none of the training state, and runs every
+// layer between two activation buffers sized to the widest layer, so
+// forward never allocates.
+//
+// Layers whose weights are mostly blocks of zeros, as Pruner leaves them,
+// run a block-sparse kernel that skips those blocks instead of the dense one.
+class InferenceNetwork
+{
+public:
+    // Layers keeping at most this share of their blocks switch to the
+    // block-sparse kernel on construction. The kernel about matches the
+    // dense ones on dense weights, this leaves a wide margin.
+    static constexpr double SPARSE_MAX_DENSITY = 0.5;
+
+    // Copies the parameters, the network stays usable for training
+    explicit InferenceNetwork(const NeuralNetwork& net);
+    // Takes the parameters over, leaving the network without weights
+    explicit InferenceNetwork(NeuralNetwork&& net);
+    // Points the layers straight into the mapped file when it has the
+    // build's precision, the file is kept open while the network lives
+    explicit InferenceNetwork(std::shared_ptr<const ModelFile> model);
+
+    // Layers view their parameters, copies would point into the original
+    InferenceNetwork(InferenceNetwork&&) = default;
+    InferenceNetwork& operator=(InferenceNetwork&&) = default;
+    InferenceNetwork(const InferenceNetwork&) = delete;
+    InferenceNetwork& operator=(const InferenceNetwork&) = delete;
+
+    // Returns the outputs for one sample. They live in an internal buffer
+    // that is overwritten by the next call.
+    std::span<const Scalar> forward(std::span<const Scalar> inputs);
+
+    // Reentrant versions, any number of threads may predict at once. The
+    // outputs live in the scratch until it is used again.
+    std::span<const Scalar> predict(std::span<const Scalar> inputs, InferenceScratch& scratch) const;
+    // Uses a scratch owned by the calling thread
+    std::span<const Scalar> predict(std::span<const Scalar> inputs) const;
+    // Inputs hold one sample per row, returns [batch x outputs]
+    MatrixView<const Scalar> predictBatch(MatrixView<const Scalar> inputs, InferenceScratch& scratch) const;
+
+    size_t getInputCount() const
+    {
+        return input_count;
+    }
+    size_t getOutputCount() const
+    {
+        return layers.empty() ? input_count : layers.back().weights.rows;
+    }
+    size_t getLayerCount() const
+    {
+        return layers.size() + 1;
+    }
+    // Bytes of parameters, mapped or not, block-sparse copies and activation buffers
+    size_t getMemoryUsage() const;
+
+    // Runs layer, counted like NeuralNetwork's layers from the first hidden
+    // one at 1, with the block-sparse or the dense kernel
+    void setBlockSparse(size_t layer, bool enabled);
+    bool isBlockSparse(size_t layer) const
+    {
+        return layers[layer - 1].sparse != nullptr;
+    }
+    // Share of the layer's blocks of BlockSparseMatrix::BLOCK_ROWS weights
+    // that are not all zero
+    double getBlockDensity(size_t layer) const;
+
+private:
+    struct FrozenLayer
+    {
+        MatrixView<const Scalar> weights;
+        std::span<const Scalar> biases;
+        std::shared_ptr<Activation> activation;
+        // Set while the layer uses the block-sparse kernel
+        std::unique_ptr<BlockSparseMatrix> sparse;
+    };
+
+    // Switches the layers sparse enough to the block-sparse kernel
+    void selectKernels();
+    // Keeps a parameter buffer alive and returns a view of it
+    const Scalar* own(AlignedVector<Scalar>&& values);
+    void allocateBuffers();
+    void reserve(InferenceScratch& scratch, size_t batch_size) const;
+
+private:
+    std::vector<FrozenLayer> layers;
+    // Parameters that are not mapped from a model file
+    std::vector<AlignedVector<Scalar>> storage;
+    std::shared_ptr<const ModelFile> model;
+    size_t input_count = 0;
+    size_t widest = 0;
+    InferenceScratch scratch;
+};
\ No newline at end of file
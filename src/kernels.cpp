@@ -0,0 +1,220 @@
+#include "kernels.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#ifdef KERNELS_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+extern const Kernels SSE4_KERNELS;
+extern const Kernels AVX2_KERNELS;
+extern const Kernels AVX512_KERNELS;
+#endif
+
+static Scalar dotScalar(const Scalar* a, const Scalar* b, size_t n)
+{
+    Scalar sum = 0.0;
+    for (size_t i = 0; i < n; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static void axpyScalar(Scalar alpha, const Scalar* x, Scalar* y, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        y[i] += alpha * x[i];
+}
+
+static int32_t dotInt8Scalar(const int8_t* a, const int8_t* b, size_t n)
+{
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += int32_t(a[i]) * b[i];
+    return sum;
+}
+
+static void sparseBlockRowScalar(const Scalar* values, const uint32_t* columns, size_t block_count, const Scalar* x, Scalar* y)
+{
+    constexpr size_t rows = Kernels::SPARSE_BLOCK_ROWS;
+    for (size_t block = 0; block < block_count; ++block)
+    {
+        const Scalar input = x[columns[block]];
+        for (size_t i = 0; i < rows; ++i)
+            y[i] += input * values[block * rows + i];
+    }
+}
+
+static void gdScalar(Scalar* weights, Scalar* deltas, Scalar learning_rate, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        weights[i] += learning_rate * deltas[i];
+        deltas[i] = 0;
+    }
+}
+
+static void sgdScalar(Scalar* weights, Scalar* velocities, Scalar* deltas, Scalar learning_rate, Scalar momentum, size_t n)
+{
+    const Scalar damping = 1 - momentum;
+    for (size_t i = 0; i < n; ++i)
+    {
+        velocities[i] = momentum * velocities[i] + damping * deltas[i];
+        weights[i] += learning_rate * velocities[i];
+        deltas[i] = 0;
+    }
+}
+
+static void adamScalar(Scalar* weights, Scalar* velocities, Scalar* square_velocities, Scalar* deltas,
+                       Scalar step_size, Scalar beta1, Scalar beta2, Scalar epsilon, size_t n)
+{
+    const Scalar one_minus_beta1 = 1 - beta1;
+    const Scalar one_minus_beta2 = 1 - beta2;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const Scalar delta = deltas[i];
+        velocities[i] = beta1 * velocities[i] + one_minus_beta1 * delta;
+        square_velocities[i] = beta2 * square_velocities[i] + one_minus_beta2 * delta * delta;
+        weights[i] += step_size * velocities[i] / (std::sqrt(square_velocities[i]) + epsilon);
+        deltas[i] = 0;
+    }
+}
+
+static void expScalar(const Scalar* x, Scalar* y, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        y[i] = std::exp(x[i]);
+}
+
+static void sigmoidScalar(const Scalar* x, Scalar* y, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        y[i] = 1 / (1 + std::exp(-x[i]));
+}
+
+static void tanhScalar(const Scalar* x, Scalar* y, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        y[i] = std::tanh(x[i]);
+}
+
+static void softplusScalar(const Scalar* x, Scalar* y, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        y[i] = std::max(x[i], (Scalar)0) + std::log1p(std::exp(-std::abs(x[i])));
+}
+
+static const Kernels SCALAR_KERNELS = {
+    .dot = dotScalar,
+    .axpy = axpyScalar,
+    .gd = gdScalar,
+    .sgd = sgdScalar,
+    .adam = adamScalar,
+    .dotInt8 = dotInt8Scalar,
+    .sparseBlockRow = sparseBlockRowScalar,
+    .exp = expScalar,
+    .sigmoid = sigmoidScalar,
+    .tanh = tanhScalar,
+    .softplus = softplusScalar,
+    .isa = Kernels::Isa::SCALAR,
+    .name = "scalar"
+};
+
+#ifdef KERNELS_X86
+static void cpuid(int info[4], int leaf, int subleaf)
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+// Register state the OS saves on context switch (XCR0)
+static uint64_t enabledStates()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+#endif
+
+bool cpuSupports(Kernels::Isa isa)
+{
+    if (isa == Kernels::Isa::SCALAR)
+        return true;
+#ifdef KERNELS_X86
+    int info[4];
+    cpuid(info, 0, 0);
+    const int max_leaf = info[0];
+    cpuid(info, 1, 0);
+    const bool sse4 = info[2] & (1 << 19);
+    const bool fma = info[2] & (1 << 12);
+    const bool osxsave = info[2] & (1 << 27);
+    if (isa == Kernels::Isa::SSE4)
+        return sse4;
+    if (!osxsave || max_leaf < 7)
+        return false;
+
+    const uint64_t states = enabledStates();
+    const bool ymm_enabled = (states & 0x6) == 0x6;
+    const bool zmm_enabled = (states & 0xE6) == 0xE6;
+    cpuid(info, 7, 0);
+    const bool avx2 = info[1] & (1 << 5);
+    const bool avx512f = info[1] & (1 << 16);
+    if (isa == Kernels::Isa::AVX2)
+        return avx2 && fma && ymm_enabled;
+    if (isa == Kernels::Isa::AVX512)
+        return avx512f && zmm_enabled;
+#endif
+    return false;
+}
+
+const Kernels* kernelsFor(Kernels::Isa isa)
+{
+    if (!cpuSupports(isa))
+        return nullptr;
+    switch (isa)
+    {
+    case Kernels::Isa::SCALAR:
+        return &SCALAR_KERNELS;
+#ifdef KERNELS_X86
+    case Kernels::Isa::SSE4:
+        return &SSE4_KERNELS;
+    case Kernels::Isa::AVX2:
+        return &AVX2_KERNELS;
+    case Kernels::Isa::AVX512:
+        return &AVX512_KERNELS;
+#endif
+    }
+    return nullptr;
+}
+
+static const Kernels& selectKernels()
+{
+    const char* names[] = { "scalar", "sse4", "avx2", "avx512" };
+    int cap = (int)Kernels::Isa::AVX512;
+    if (const char* limit = std::getenv("NN_KERNELS"))
+        for (int isa = 0; isa <= (int)Kernels::Isa::AVX512; ++isa)
+            if (strcmp(limit, names[isa]) == 0)
+                cap = isa;
+
+    for (int isa = cap; isa > 0; --isa)
+        if (const Kernels* candidate = kernelsFor((Kernels::Isa)isa))
+            return *candidate;
+    return SCALAR_KERNELS;
+}
+
+const Kernels& kernels()
+{
+    static const Kernels& selected = selectKernels();
+    return selected;
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "scalar.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define KERNELS_X86
+#endif
+
+// Dense inner loops of the layers and optimizers. One table exists per
+// instruction set, kernels() picks the widest one the running CPU supports.
+struct Kernels
+{
+    enum class Isa: uint8_t
+    {
+        SCALAR,
+        SSE4,
+        AVX2,
+        AVX512
+    };
+
+    static constexpr size_t SPARSE_BLOCK_ROWS = 8;
+
+    // Returns sum(a[i] * b[i])
+    Scalar (*dot)(const Scalar* a, const Scalar* b, size_t n);
+    // y += alpha * x
+    void (*axpy)(Scalar alpha, const Scalar* x, Scalar* y, size_t n);
+
+    // Optimizer steps make a single pass over their arrays and clear the
+    // deltas after reading them, ready for the next accumulation.
+    // weights += learning_rate * deltas
+    void (*gd)(Scalar* weights, Scalar* deltas, Scalar learning_rate, size_t n);
+    // Momentum step, see Sgd::update
+    void (*sgd)(Scalar* weights, Scalar* velocities, Scalar* deltas, Scalar learning_rate, Scalar momentum, size_t n);
+    // Adam step with the bias correction folded into step_size and epsilon,
+    // see Adam::update
+    void (*adam)(Scalar* weights, Scalar* velocities, Scalar* square_velocities, Scalar* deltas,
+                 Scalar step_size, Scalar beta1, Scalar beta2, Scalar epsilon, size_t n);
+
+    // Returns sum(a[i] * b[i]) with 32-bit accumulation, exact as long as
+    // n stays below 2^31 / 127^2 for inputs in [-127, 127]
+    int32_t (*dotInt8)(const int8_t* a, const int8_t* b, size_t n);
+
+    // One block row of a BlockSparseMatrix times a vector. Every block holds
+    // SPARSE_BLOCK_ROWS values of one column, y[0, SPARSE_BLOCK_ROWS) +=
+    // x[columns[b]] * values[b * SPARSE_BLOCK_ROWS + i] summed over the blocks.
+    void (*sparseBlockRow)(const Scalar* values, const uint32_t* columns, size_t block_count, const Scalar* x, Scalar* y);
+
+    // Elementwise y = f(x), x and y may alias. The scalar table calls the C
+    // library, the SIMD tables use a polynomial exp with relative error below
+    // 4e-16 (double) or 2e-7 (float) for inputs in [-708, 709] ([-87, 88] for
+    // float), inputs outside are clamped. sigmoid and tanh built on it stay
+    // within 2 ulp of 1 in absolute error, softplus within 4 ulp of max(|x|, 1).
+    void (*exp)(const Scalar* x, Scalar* y, size_t n);
+    void (*sigmoid)(const Scalar* x, Scalar* y, size_t n);
+    void (*tanh)(const Scalar* x, Scalar* y, size_t n);
+    void (*softplus)(const Scalar* x, Scalar* y, size_t n);
+
+    Isa isa;
+    const char* name;
+};
+
+// Best kernels for this CPU, chosen once at startup. Setting the NN_KERNELS
+// environment variable to scalar, sse4, avx2 or avx512 caps the choice.
+const Kernels& kernels();
+
+// Kernels for a specific instruction set, nullptr if the CPU or the build lacks it
+const Kernels* kernelsFor(Kernels::Isa isa);
+
+bool cpuSupports(Kernels::Isa isa);
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+
+#include <immintrin.h>
+#include "kernels_simd.h"
+
+struct Avx2Double
+{
+    using Vec = __m256d;
+    static constexpr size_t WIDTH = 4;
+
+    static Vec zero() { return _mm256_setzero_pd(); }
+    static Vec set(double x) { return _mm256_set1_pd(x); }
+    static Vec load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, Vec v) { _mm256_storeu_pd(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+    static Vec sqrt(Vec a) { return _mm256_sqrt_pd(a); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm256_fmadd_pd(a, b, c); }
+    static Vec sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm256_min_pd(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm256_max_pd(a, b); }
+    static Vec round(Vec a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Vec pow2(Vec n)
+    {
+        __m256i bits = _mm256_cvtepi32_epi64(_mm_add_epi32(_mm256_cvtpd_epi32(n), _mm_set1_epi32(1023)));
+        return _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+    }
+    static double reduce(Vec v)
+    {
+        __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_pd(sum, _mm_unpackhi_pd(sum, sum)));
+    }
+};
+
+struct Avx2Float
+{
+    using Vec = __m256;
+    static constexpr size_t WIDTH = 8;
+
+    static Vec zero() { return _mm256_setzero_ps(); }
+    static Vec set(float x) { return _mm256_set1_ps(x); }
+    static Vec load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, Vec v) { _mm256_storeu_ps(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm256_div_ps(a, b); }
+    static Vec sqrt(Vec a) { return _mm256_sqrt_ps(a); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm256_fmadd_ps(a, b, c); }
+    static Vec sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm256_min_ps(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm256_max_ps(a, b); }
+    static Vec round(Vec a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Vec pow2(Vec n)
+    {
+        __m256i bits = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+    }
+    static float reduce(Vec v)
+    {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+    }
+};
+
+using Avx2 = std::conditional_t<SCALAR_PRECISION == Precision::FLOAT32, Avx2Float, Avx2Double>;
+
+static int32_t dotInt8Avx2(const int8_t* a, const int8_t* b, size_t n)
+{
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b + i)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vb));
+    }
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    return dotInt8Tail(a, b, i, n, _mm_cvtsi128_si32(half));
+}
+
+extern const Kernels AVX2_KERNELS = makeSimdKernels<Avx2>(Kernels::Isa::AVX2, "avx2", dotInt8Avx2);
+
+#endif
\ No newline at end of file
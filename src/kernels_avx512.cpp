@@ -0,0 +1,79 @@
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+
+#include <immintrin.h>
+#include "kernels_simd.h"
+
+struct Avx512Double
+{
+    using Vec = __m512d;
+    static constexpr size_t WIDTH = 8;
+
+    static Vec zero() { return _mm512_setzero_pd(); }
+    static Vec set(double x) { return _mm512_set1_pd(x); }
+    static Vec load(const double* p) { return _mm512_loadu_pd(p); }
+    static void store(double* p, Vec v) { _mm512_storeu_pd(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm512_div_pd(a, b); }
+    static Vec sqrt(Vec a) { return _mm512_sqrt_pd(a); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm512_fmadd_pd(a, b, c); }
+    static Vec sub(Vec a, Vec b) { return _mm512_sub_pd(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm512_min_pd(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm512_max_pd(a, b); }
+    static Vec round(Vec a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Vec pow2(Vec n) { return _mm512_scalef_pd(_mm512_set1_pd(1.0), n); }
+    static double reduce(Vec v) { return _mm512_reduce_add_pd(v); }
+};
+
+struct Avx512Float
+{
+    using Vec = __m512;
+    static constexpr size_t WIDTH = 16;
+
+    static Vec zero() { return _mm512_setzero_ps(); }
+    static Vec set(float x) { return _mm512_set1_ps(x); }
+    static Vec load(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, Vec v) { _mm512_storeu_ps(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm512_mul_ps(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm512_div_ps(a, b); }
+    static Vec sqrt(Vec a) { return _mm512_sqrt_ps(a); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm512_fmadd_ps(a, b, c); }
+    static Vec sub(Vec a, Vec b) { return _mm512_sub_ps(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm512_min_ps(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm512_max_ps(a, b); }
+    static Vec round(Vec a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Vec pow2(Vec n) { return _mm512_scalef_ps(_mm512_set1_ps(1.0f), n); }
+    static float reduce(Vec v) { return _mm512_reduce_add_ps(v); }
+    // For blocks half a vector wide: lanes 0-7 hold lower, lanes 8-15 upper
+    static Vec setHalves(float lower, float upper) { return _mm512_mask_blend_ps(0xff00, _mm512_set1_ps(lower), _mm512_set1_ps(upper)); }
+    // p[0, 8) += lower half + upper half
+    static void addHalves(float* p, Vec v)
+    {
+        __m256 upper = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+        _mm256_storeu_ps(p, _mm256_add_ps(_mm256_loadu_ps(p), _mm256_add_ps(_mm512_castps512_ps256(v), upper)));
+    }
+};
+
+using Avx512 = std::conditional_t<SCALAR_PRECISION == Precision::FLOAT32, Avx512Float, Avx512Double>;
+
+// Only needs AVX-512F: bytes are widened straight to 32 bits since the
+// 16-bit multiply-add is part of AVX-512BW
+static int32_t dotInt8Avx512(const int8_t* a, const int8_t* b, size_t n)
+{
+    __m512i sum = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512i va = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(a + i)));
+        __m512i vb = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(b + i)));
+        sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(va, vb));
+    }
+    return dotInt8Tail(a, b, i, n, _mm512_reduce_add_epi32(sum));
+}
+
+extern const Kernels AVX512_KERNELS = makeSimdKernels<Avx512>(Kernels::Isa::AVX512, "avx512", dotInt8Avx512);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+
+#include <immintrin.h>
+#include "kernels_simd.h"
+
+struct Sse4Double
+{
+    using Vec = __m128d;
+    static constexpr size_t WIDTH = 2;
+
+    static Vec zero() { return _mm_setzero_pd(); }
+    static Vec set(double x) { return _mm_set1_pd(x); }
+    static Vec load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, Vec v) { _mm_storeu_pd(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm_div_pd(a, b); }
+    static Vec sqrt(Vec a) { return _mm_sqrt_pd(a); }
+    // No FMA before AVX2, a separate multiply and add keeps results portable
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static Vec sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm_min_pd(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm_max_pd(a, b); }
+    static Vec round(Vec a) { return _mm_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    // 2^n for integral n inside the exponent range
+    static Vec pow2(Vec n)
+    {
+        __m128i bits = _mm_cvtepi32_epi64(_mm_add_epi32(_mm_cvtpd_epi32(n), _mm_set1_epi32(1023)));
+        return _mm_castsi128_pd(_mm_slli_epi64(bits, 52));
+    }
+    static double reduce(Vec v) { return _mm_cvtsd_f64(_mm_add_pd(v, _mm_unpackhi_pd(v, v))); }
+};
+
+struct Sse4Float
+{
+    using Vec = __m128;
+    static constexpr size_t WIDTH = 4;
+
+    static Vec zero() { return _mm_setzero_ps(); }
+    static Vec set(float x) { return _mm_set1_ps(x); }
+    static Vec load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, Vec v) { _mm_storeu_ps(p, v); }
+    static Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm_div_ps(a, b); }
+    static Vec sqrt(Vec a) { return _mm_sqrt_ps(a); }
+    static Vec fmadd(Vec a, Vec b, Vec c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static Vec sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+    static Vec min(Vec a, Vec b) { return _mm_min_ps(a, b); }
+    static Vec max(Vec a, Vec b) { return _mm_max_ps(a, b); }
+    static Vec round(Vec a) { return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static Vec pow2(Vec n)
+    {
+        __m128i bits = _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127));
+        return _mm_castsi128_ps(_mm_slli_epi32(bits, 23));
+    }
+    static float reduce(Vec v)
+    {
+        __m128 sum = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+    }
+};
+
+using Sse4 = std::conditional_t<SCALAR_PRECISION == Precision::FLOAT32, Sse4Float, Sse4Double>;
+
+// Sign-extends 8 bytes at a time and sums pairs of 16-bit products
+static int32_t dotInt8Sse4(const int8_t* a, const int8_t* b, size_t n)
+{
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_cvtepi8_epi16(va), _mm_cvtepi8_epi16(vb)));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_cvtepi8_epi16(_mm_srli_si128(va, 8)), _mm_cvtepi8_epi16(_mm_srli_si128(vb, 8))));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return dotInt8Tail(a, b, i, n, _mm_cvtsi128_si32(sum));
+}
+
+extern const Kernels SSE4_KERNELS = makeSimdKernels<Sse4>(Kernels::Isa::SSE4, "sse4", dotInt8Sse4);
+
+#endif
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "layer.h"
 #include "neural_network.h"
+#include "gemm.h"
+#include "kernels.h"
+#include "profiler.h"
 
 Layer::Layer(NeuralNetwork& neural_network, size_t index, size_t input_size, size_t size, const std::shared_ptr<Activation>& activation)
     : net(&neural_network), index(index), input_size(input_size), size(size), activation(activation)
@@ -16,49 +19,221 @@ void Layer::build()
         neuron_errors.resize(size);
         biases.resize(size);
         delta_biases.resize(size);
-        weights.resize(size);
-        delta_weights.resize(size);
-        for (size_t neuron = 0; neuron < size; ++neuron)
-        {
-            weights[neuron].resize(input_size);
-            delta_weights[neuron].resize(input_size);
-        }
+        weights.resize(size, input_size);
+        delta_weights.resize(size, input_size);
     }
 }
 
+ThreadPool* Layer::parallelPool() const
+{
+    // Small layers finish faster than the pool can hand out their tasks
+    return size * input_size >= PARALLEL_MIN_WEIGHTS ? net->getThreadPool() : nullptr;
+}
+
+size_t Layer::neuronGrain() const
+{
+    return std::max<size_t>(1, PARALLEL_MIN_WEIGHTS / 2 / input_size);
+}
+
+ThreadPool* Layer::sparsePool(size_t non_zeros) const
+{
+    return size * non_zeros >= PARALLEL_MIN_WEIGHTS ? net->getThreadPool() : nullptr;
+}
+
+size_t Layer::sparseGrain(size_t non_zeros) const
+{
+    return std::max<size_t>(1, PARALLEL_MIN_WEIGHTS / 2 / std::max<size_t>(1, non_zeros));
+}
+
 void Layer::forward()
 {
-    const auto& prev_layer = net->layers[index - 1];
-    for (size_t neuron = 0; neuron < size; ++neuron)
+    NN_PROFILE_SCOPE("forward", index, 2.0 * weights.size(), weights.size() * sizeof(Scalar));
+    const Kernels& kern = kernels();
+    const Scalar* inputs = net->layers[index - 1].activated_neurons.data();
+    parallelFor(parallelPool(), size, neuronGrain(), [&](size_t begin, size_t end)
     {
-        neurons[neuron] = biases[neuron];
-        for (size_t prev_neuron = 0; prev_neuron < input_size; ++prev_neuron)
-            neurons[neuron] += prev_layer.activated_neurons[prev_neuron] * weights[neuron][prev_neuron];
-        activated_neurons[neuron] = (*activation)(neurons[neuron]);
-    }
+        for (size_t neuron = begin; neuron < end; ++neuron)
+            neurons[neuron] = biases[neuron] + kern.dot(weights[neuron], inputs, input_size);
+    });
+    activation->apply(neurons, activated_neurons);
 }
 
-void Layer::calculateGradients(const std::vector<double>& targets)
+void Layer::calculateGradients(const std::vector<Scalar>& targets)
 {
+    const Kernels& kern = kernels();
     auto& prev_layer = net->layers[index - 1];
     if (index > 1)
     {
-        for (size_t prev_neuron = 0; prev_neuron < input_size; ++prev_neuron)
+        NN_PROFILE_SCOPE("propagate_errors", index, 2.0 * weights.size(), weights.size() * sizeof(Scalar));
+        // Walk weights row by row so error propagation streams through contiguous memory,
+        // threads own disjoint column ranges of the previous layer's errors
+        Scalar* prev_errors = prev_layer.neuron_errors.data();
+        std::fill(prev_layer.neuron_errors.begin(), prev_layer.neuron_errors.end(), 0.0);
+        parallelFor(parallelPool(), input_size, PARALLEL_MIN_COLUMNS, [&](size_t begin, size_t end)
         {
-            prev_layer.neuron_errors[prev_neuron] = 0.0;
             for (size_t neuron = 0; neuron < size; ++neuron)
-                prev_layer.neuron_errors[prev_neuron] += neuron_errors[neuron] * weights[neuron][prev_neuron];
-            prev_layer.neuron_errors[prev_neuron] *= prev_layer.activation->derivative(prev_layer.neurons[prev_neuron]);
+                kern.axpy(neuron_errors[neuron], weights[neuron] + begin, prev_errors + begin, end - begin);
+        });
+        prev_layer.activation->backpropagate(prev_layer.neurons, prev_layer.activated_neurons, prev_layer.neuron_errors);
+    }
+    NN_PROFILE_SCOPE("weight_gradients", index, 2.0 * weights.size(), 2.0 * weights.size() * sizeof(Scalar));
+    const Scalar* prev_activations = prev_layer.activated_neurons.data();
+    parallelFor(parallelPool(), size, neuronGrain(), [&](size_t begin, size_t end)
+    {
+        for (size_t neuron = begin; neuron < end; ++neuron)
+            kern.axpy(neuron_errors[neuron], prev_activations, delta_weights[neuron], input_size);
+    });
+
+    kern.axpy(1.0, neuron_errors.data(), delta_biases.data(), size);
+}
+
+void Layer::forwardBatch(const LayerBatch& prev_batch, LayerBatch& batch) const
+{
+    const size_t batch_size = prev_batch.activated_neurons.rows;
+    NN_PROFILE_SCOPE("forward_batch", index, 2.0 * batch_size * weights.size(), (weights.size() + batch_size * (input_size + size)) * sizeof(Scalar));
+    for (size_t sample = 0; sample < batch_size; ++sample)
+        std::copy(biases.begin(), biases.end(), batch.neurons[sample]);
+
+    gemmNT(prev_batch.activated_neurons.view(), weights.view(), batch.neurons.view(), net->getThreadPool());
+
+    activation->applyBatch(batch.neurons.view(), batch.activated_neurons.view());
+}
+
+void Layer::backwardBatch(LayerBatch& prev_batch, const LayerBatch& batch)
+{
+    backwardBatch(prev_batch, batch, delta_weights.view(), delta_biases);
+}
+
+void Layer::backwardBatch(LayerBatch& prev_batch, const LayerBatch& batch, MatrixView<Scalar> gradient_weights, std::span<Scalar> gradient_biases) const
+{
+    const size_t batch_size = batch.neuron_errors.rows;
+    if (index > 1)
+    {
+        NN_PROFILE_SCOPE("propagate_errors_batch", index, 2.0 * batch_size * weights.size(), (weights.size() + batch_size * (input_size + size)) * sizeof(Scalar));
+        auto& prev_layer = net->layers[index - 1];
+        prev_batch.neuron_errors.fill(0.0);
+        gemmNN(batch.neuron_errors.view(), weights.view(), prev_batch.neuron_errors.view(), net->getThreadPool());
+        prev_layer.activation->backpropagateBatch(prev_batch.neurons.view(), prev_batch.activated_neurons.view(), prev_batch.neuron_errors.view());
+    }
+
+    NN_PROFILE_SCOPE("weight_gradients_batch", index, 2.0 * batch_size * weights.size(), (2 * weights.size() + batch_size * (input_size + size)) * sizeof(Scalar));
+    gemmTN(batch.neuron_errors.view(), prev_batch.activated_neurons.view(), gradient_weights, net->getThreadPool());
+
+    const Kernels& kern = kernels();
+    for (size_t sample = 0; sample < batch_size; ++sample)
+        kern.axpy(1.0, batch.neuron_errors[sample], gradient_biases.data(), size);
+}
+
+void Layer::forwardBatch(const HalfLayerBatch& prev_batch, LayerBatch& batch) const
+{
+    const size_t batch_size = prev_batch.activated_neurons.rows;
+    NN_PROFILE_SCOPE("forward_batch_mixed", index, 2.0 * batch_size * weights.size(), weights.size() * sizeof(Scalar) + batch_size * (input_size * sizeof(BFloat16) + size * sizeof(Scalar)));
+    for (size_t sample = 0; sample < batch_size; ++sample)
+        std::copy(biases.begin(), biases.end(), batch.neurons[sample]);
+
+    gemmNT(prev_batch.activated_neurons.view(), weights.view(), batch.neurons.view(), net->getThreadPool());
+
+    activation->applyBatch(batch.neurons.view(), batch.activated_neurons.view());
+}
+
+void Layer::backwardBatch(HalfLayerBatch& prev_batch, const HalfLayerBatch& batch, LayerBatch& scratch, MatrixView<Scalar> gradient_weights, std::span<Scalar> gradient_biases) const
+{
+    const size_t batch_size = batch.neuron_errors.rows;
+    if (index > 1)
+    {
+        NN_PROFILE_SCOPE("propagate_errors_batch_mixed", index, 2.0 * batch_size * weights.size(), weights.size() * sizeof(Scalar) + batch_size * (input_size + size) * sizeof(BFloat16));
+        auto& prev_layer = net->layers[index - 1];
+        scratch.neuron_errors.resize(batch_size, input_size);
+        scratch.neuron_errors.fill(0.0);
+        gemmNN(batch.neuron_errors.view(), weights.view(), scratch.neuron_errors.view(), net->getThreadPool());
+
+        // The stored activations are widened a row at a time
+        scratch.neurons.resize(1, input_size);
+        scratch.activated_neurons.resize(1, input_size);
+        for (size_t sample = 0; sample < batch_size; ++sample)
+        {
+            toScalar(prev_batch.neurons[sample], scratch.neurons.data(), input_size);
+            toScalar(prev_batch.activated_neurons[sample], scratch.activated_neurons.data(), input_size);
+            prev_layer.activation->backpropagate(scratch.neurons.values, scratch.activated_neurons.values, { scratch.neuron_errors[sample], input_size });
         }
+        prev_batch.neuron_errors.resize(batch_size, input_size);
+        toBFloat16(scratch.neuron_errors.data(), prev_batch.neuron_errors.data(), scratch.neuron_errors.size());
     }
-    for (size_t prev_neuron = 0; prev_neuron < input_size; ++prev_neuron)
+
+    NN_PROFILE_SCOPE("weight_gradients_batch_mixed", index, 2.0 * batch_size * weights.size(), 2 * weights.size() * sizeof(Scalar) + batch_size * (input_size + size) * sizeof(BFloat16));
+    gemmTN(batch.neuron_errors.view(), prev_batch.activated_neurons.view(), gradient_weights, net->getThreadPool());
+
+    for (size_t sample = 0; sample < batch_size; ++sample)
+    {
+        const BFloat16* errors = batch.neuron_errors[sample];
         for (size_t neuron = 0; neuron < size; ++neuron)
-            delta_weights[neuron][prev_neuron] += neuron_errors[neuron] * prev_layer.activated_neurons[prev_neuron];
+            gradient_biases[neuron] += toScalar(errors[neuron]);
+    }
+}
 
-    for (size_t neuron = 0; neuron < size; ++neuron)
-        delta_biases[neuron] += neuron_errors[neuron];
+void Layer::forwardSparse(const SparseBatch& inputs, LayerBatch& batch) const
+{
+    NN_PROFILE_SCOPE("forward_sparse", index, 2.0 * size * inputs.nonZeros(), (double)size * inputs.nonZeros() * sizeof(Scalar));
+    // Threads own disjoint neurons, each row of weights is gathered from
+    // once for all samples while its active columns are in cache
+    parallelFor(sparsePool(inputs.nonZeros()), size, sparseGrain(inputs.nonZeros()), [&](size_t begin, size_t end)
+    {
+        for (size_t neuron = begin; neuron < end; ++neuron)
+        {
+            const Scalar* row = weights[neuron];
+            for (size_t sample = 0; sample < inputs.rows(); ++sample)
+            {
+                const auto indices = inputs.rowIndices(sample);
+                Scalar sum = biases[neuron];
+                if (inputs.isBinary())
+                {
+                    for (uint32_t input : indices)
+                        sum += row[input];
+                }
+                else
+                {
+                    const auto values = inputs.rowValues(sample);
+                    for (size_t i = 0; i < indices.size(); ++i)
+                        sum += row[indices[i]] * values[i];
+                }
+                batch.neurons[sample][neuron] = sum;
+            }
+        }
+    });
+
+    activation->applyBatch(batch.neurons.view(), batch.activated_neurons.view());
 }
 
+void Layer::backwardSparse(const SparseBatch& inputs, const LayerBatch& batch, MatrixView<Scalar> gradient_weights, std::span<Scalar> gradient_biases) const
+{
+    NN_PROFILE_SCOPE("weight_gradients_sparse", index, 2.0 * size * inputs.nonZeros(), 2.0 * size * inputs.nonZeros() * sizeof(Scalar));
+    parallelFor(sparsePool(inputs.nonZeros()), size, sparseGrain(inputs.nonZeros()), [&](size_t begin, size_t end)
+    {
+        for (size_t neuron = begin; neuron < end; ++neuron)
+        {
+            Scalar* row = gradient_weights[neuron];
+            Scalar bias_gradient = 0;
+            for (size_t sample = 0; sample < inputs.rows(); ++sample)
+            {
+                const Scalar error = batch.neuron_errors[sample][neuron];
+                bias_gradient += error;
+                const auto indices = inputs.rowIndices(sample);
+                if (inputs.isBinary())
+                {
+                    for (uint32_t input : indices)
+                        row[input] += error;
+                }
+                else
+                {
+                    const auto values = inputs.rowValues(sample);
+                    for (size_t i = 0; i < indices.size(); ++i)
+                        row[indices[i]] += error * values[i];
+                }
+            }
+            gradient_biases[neuron] += bias_gradient;
+        }
+    });
+}
 
 void Layer::save(std::ostream& os) const
 {
@@ -67,14 +242,11 @@ void Layer::save(std::ostream& os) const
     os.write((const char*)&index, sizeof(index));
     os.write((const char*)&activation->type, sizeof(activation->type));
     os << *activation;
-    for (size_t neuron = 0; neuron < size; ++neuron)
-        for (size_t prev_neuron = 0; prev_neuron < weights.size(); ++prev_neuron)
-            os.write((const char*)&weights[neuron][prev_neuron], sizeof(weights[neuron][prev_neuron]));
-    for (size_t neuron = 0; neuron < size; ++neuron)
-        os.write((const char*)&biases[neuron], sizeof(biases[neuron]));
+    os.write((const char*)weights.data(), weights.size() * sizeof(Scalar));
+    os.write((const char*)biases.data(), biases.size() * sizeof(Scalar));
 }
 
-void Layer::load(std::istream& is)
+void Layer::load(std::istream& is, Precision precision)
 {
     is.read((char*)&size, sizeof(size));
     is.read((char*)&input_size, sizeof(input_size));
@@ -84,10 +256,6 @@ void Layer::load(std::istream& is)
     activation = ActivationFactory::build(activation_type);
     is >> *activation;
     build();
-    for (size_t neuron = 0; neuron < size; ++neuron)
-        for (size_t prev_neuron = 0; prev_neuron < weights.size(); ++prev_neuron)
-            is.read((char*)&weights[neuron][prev_neuron], sizeof(weights[neuron][prev_neuron]));
-    for (size_t neuron = 0; neuron < size; ++neuron)
-        is.read((char*)&biases[neuron], sizeof(biases[neuron]));
-
+    readScalars(is, weights.data(), weights.size(), precision);
+    readScalars(is, biases.data(), biases.size(), precision);
 }
\ No newline at end of file
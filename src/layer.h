@@ -3,6 +3,25 @@
 #include <vector>
 #include <memory>
 #include "activations.h"
+#include "matrix.h"
+#include "thread_pool.h"
+#include "sparse.h"
+#include "mixed_precision.h"
+
+// Activations of one layer for a whole mini-batch, each matrix is [batch x layer size]
+struct LayerBatch
+{
+    void resize(size_t batch_size, size_t layer_size)
+    {
+        neurons.resize(batch_size, layer_size);
+        activated_neurons.resize(batch_size, layer_size);
+        neuron_errors.resize(batch_size, layer_size);
+    }
+
+    Matrix neurons;
+    Matrix activated_neurons;
+    Matrix neuron_errors;
+};
 
 class Layer
 {
@@ -14,10 +33,26 @@ public:
     void build();
 
     void forward();
-    void calculateGradients(const std::vector<double>& targets);
+    void calculateGradients(const std::vector<Scalar>& targets);
+
+    void forwardBatch(const LayerBatch& prev_batch, LayerBatch& batch) const;
+    void backwardBatch(LayerBatch& prev_batch, const LayerBatch& batch);
+    // Accumulates the gradients into the given buffers instead of the layer's own
+    void backwardBatch(LayerBatch& prev_batch, const LayerBatch& batch, MatrixView<Scalar> gradient_weights, std::span<Scalar> gradient_biases) const;
+    // First hidden layer passes on sparse inputs, only the weight columns of
+    // nonzero inputs are read or accumulated into
+    void forwardSparse(const SparseBatch& inputs, LayerBatch& batch) const;
+    void backwardSparse(const SparseBatch& inputs, const LayerBatch& batch, MatrixView<Scalar> gradient_weights, std::span<Scalar> gradient_biases) const;
+    // Mixed-precision passes reading the previous layer's activations and
+    // this layer's errors in bfloat16. The forward pass computes batch in
+    // Scalar, the backward pass leaves the previous layer's errors rounded to
+    // bfloat16 and uses scratch for their Scalar sums.
+    void forwardBatch(const HalfLayerBatch& prev_batch, LayerBatch& batch) const;
+    void backwardBatch(HalfLayerBatch& prev_batch, const HalfLayerBatch& batch, LayerBatch& scratch, MatrixView<Scalar> gradient_weights, std::span<Scalar> gradient_biases) const;
 
     void save(std::ostream& os) const;
-    void load(std::istream& is);
+    // Weights are converted when the stream was saved with a different precision
+    void load(std::istream& is, Precision precision = SCALAR_PRECISION);
 
     static friend std::ostream &operator<<(std::ostream &os, const Layer &layer)
     {
@@ -30,16 +65,28 @@ public:
         return is;
     }
 
+protected:
+    // Single-sample passes only split layers with at least this many weights
+    static constexpr size_t PARALLEL_MIN_WEIGHTS = 1 << 15;
+    static constexpr size_t PARALLEL_MIN_COLUMNS = 256;
+
+    ThreadPool* parallelPool() const;
+    size_t neuronGrain() const;
+    // Same for passes reading non_zeros inputs per neuron
+    ThreadPool* sparsePool(size_t non_zeros) const;
+    size_t sparseGrain(size_t non_zeros) const;
+
+public:
     NeuralNetwork* net;
-    size_t size;
-    size_t input_size;
-    size_t index;
-    std::vector<double> neurons;
-    std::vector<double> activated_neurons;
-    std::vector<double> neuron_errors;
-    std::vector<double> biases;
-    std::vector<double> delta_biases;
-    std::vector<std::vector<double>> weights; // [Layer][Neuron][Weight coming from previous neuron layer neurons to this neuron]
-    std::vector<std::vector<double>> delta_weights;
+    size_t size = 0;
+    size_t input_size = 0;
+    size_t index = 0;
+    AlignedVector<Scalar> neurons;
+    AlignedVector<Scalar> activated_neurons;
+    AlignedVector<Scalar> neuron_errors;
+    AlignedVector<Scalar> biases;
+    AlignedVector<Scalar> delta_biases;
+    Matrix weights; // [Neuron][Weight coming from previous neuron layer neurons to this neuron]
+    Matrix delta_weights;
     std::shared_ptr<Activation> activation;
 };
\ No newline at end of file
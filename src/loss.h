@@ -1,6 +1,107 @@
 #pragma once
 
-class Loss
+#include <span>
+#include <cmath>
+#include <stdexcept>
+#include "activations.h"
+
+// Objective minimized by training. A loss turns the output layer's
+// pre-activations z, activations y and the targets into errors with respect
+// to z, in the network's convention errors = -dL/dz.
+struct Loss
+{
+    enum class Type: uint8_t
+    {
+        MEAN_SQUARED_ERROR,
+        SOFTMAX_CROSS_ENTROPY
+    };
+
+public:
+    Loss(Type type)
+        : type(type)
+    {}
+    virtual ~Loss() = default;
+
+    // Loss of one sample
+    virtual double evaluate(std::span<const Scalar> z, std::span<const Scalar> y, std::span<const Scalar> targets) const = 0;
+    virtual void outputErrors(const Activation& activation, std::span<const Scalar> z, std::span<const Scalar> y,
+                              std::span<const Scalar> targets, std::span<Scalar> errors) const = 0;
+
+    // Row by row versions for [batch x size] matrices
+    double evaluateBatch(MatrixView<const Scalar> z, MatrixView<const Scalar> y, MatrixView<const Scalar> targets) const
+    {
+        double sum = 0.0;
+        for (size_t row = 0; row < z.rows; ++row)
+            sum += evaluate({ z[row], z.cols }, { y[row], y.cols }, { targets[row], targets.cols });
+        return sum;
+    }
+    void outputErrorsBatch(const Activation& activation, MatrixView<const Scalar> z, MatrixView<const Scalar> y,
+                           MatrixView<const Scalar> targets, MatrixView<Scalar> errors) const
+    {
+        for (size_t row = 0; row < z.rows; ++row)
+            outputErrors(activation, { z[row], z.cols }, { y[row], y.cols }, { targets[row], targets.cols }, { errors[row], errors.cols });
+    }
+
+    const Type type;
+};
+
+// Mean of the squared errors over the outputs, works with any output activation
+struct MeanSquaredError: public Loss
+{
+    MeanSquaredError()
+        : Loss(Type::MEAN_SQUARED_ERROR)
+    {}
+
+    double evaluate(std::span<const Scalar>, std::span<const Scalar> y, std::span<const Scalar> targets) const override
+    {
+        double cost = 0.0;
+        for (size_t i = 0; i < y.size(); ++i)
+            cost += (targets[i] - y[i]) * (targets[i] - y[i]);
+        return cost / y.size();
+    }
+    void outputErrors(const Activation& activation, std::span<const Scalar> z, std::span<const Scalar> y,
+                      std::span<const Scalar> targets, std::span<Scalar> errors) const override
+    {
+        for (size_t i = 0; i < y.size(); ++i)
+            errors[i] = targets[i] - y[i];
+        activation.backpropagate(z, y, errors);
+    }
+};
+
+// Cross-entropy of a Softmax output layer. The gradient with respect to z
+// is targets - y * sum(targets), so the softmax Jacobian is never applied,
+// and the loss is evaluated through log-sum-exp of z, so it stays finite
+// when probabilities underflow.
+struct SoftmaxCrossEntropy: public Loss
 {
+    SoftmaxCrossEntropy()
+        : Loss(Type::SOFTMAX_CROSS_ENTROPY)
+    {}
 
+    // -sum(t * log(softmax(z))) = sum(t) * logsumexp(z) - sum(t * z)
+    double evaluate(std::span<const Scalar> z, std::span<const Scalar>, std::span<const Scalar> targets) const override
+    {
+        const Scalar max = *std::max_element(z.begin(), z.end());
+        double exp_sum = 0.0;
+        double target_sum = 0.0;
+        double weighted_sum = 0.0;
+        for (size_t i = 0; i < z.size(); ++i)
+        {
+            exp_sum += std::exp(double(z[i] - max));
+            target_sum += targets[i];
+            weighted_sum += targets[i] * double(z[i] - max);
+        }
+        return target_sum * std::log(exp_sum) - weighted_sum;
+    }
+    void outputErrors(const Activation& activation, std::span<const Scalar>, std::span<const Scalar> y,
+                      std::span<const Scalar> targets, std::span<Scalar> errors) const override
+    {
+        if (activation.type != Activation::Type::SOFTMAX)
+            throw std::logic_error("SoftmaxCrossEntropy needs a Softmax output layer");
+        Scalar target_sum = 0.0;
+        for (Scalar target : targets)
+            target_sum += target;
+        for (size_t i = 0; i < y.size(); ++i)
+            errors[i] = targets[i] - y[i] * target_sum;
+    }
 };
\ No newline at end of file
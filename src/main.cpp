@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include <chrono>
 #include "neural_network.h"
 #include "random.h"
@@ -41,23 +42,7 @@ private:
     bool show_millis;
 };
 
-static void makeLittleEndian(uint32_t& num)
-{
-    num = ((num >> 24) & 0xff) |
-        ((num << 8) & 0xff0000) |
-        ((num >> 8) & 0xff00) |
-        ((num << 24) & 0xff000000);
-}
-
-static std::vector<double> classToVector(size_t Class, size_t max_size)
-{
-    //TODO: Assert that Class < max_size;
-    std::vector<double> vec(max_size, 0.0f);
-    vec[Class] = 1.0f;
-    return vec;
-}
-
-static size_t vectorToClass(const std::vector<float>& vec)
+static size_t vectorToClass(const std::vector<Scalar>& vec)
 {
     return size_t(std::max_element(vec.begin(), vec.end()) - vec.begin());
 }
@@ -81,76 +66,35 @@ static std::vector<std::vector<T>> splitVector(const std::vector<T>& vec, size_t
     return out_vec;
 }
 
-static std::vector<std::vector<double>> loadImages(const char* path)
-{
-    std::ifstream is(path, std::ios::binary);
-    uint32_t magic_number = 0;
-    is.read((char*)&magic_number, 4); //TODO: Assert that magic number is correct
-    makeLittleEndian(magic_number);
-    uint32_t images = 0;
-    is.read((char*)&images, 4);
-    makeLittleEndian(images);
-    uint32_t width = 0;
-    is.read((char*)&width, 4);
-    makeLittleEndian(width);
-    uint32_t height = 0;
-    is.read((char*)&height, 4);
-    makeLittleEndian(height);
-    std::vector<std::vector<uint8_t>> data(images);
-    for (auto& image : data)
-    {
-        image.resize(width * height);
-        is.read((char*)image.data(), width * height);
-    }
-    std::vector<std::vector<double>> normalized_data(data.size());
-    for (size_t i = 0; i < normalized_data.size(); ++i)
-    {
-        normalized_data[i].resize(data[i].size());
-        for (size_t j = 0; j < width * height; ++j)
-            normalized_data[i][j] = (data[i][j] >= 128 ? 1.0 : 0.0);
-    }
-    return normalized_data;
-}
-
-static std::vector<std::vector<double>> loadLabels(const char* path)
-{
-    std::ifstream is(path, std::ios::binary);
-    uint32_t magic_number = 0;
-    is.read((char*)&magic_number, 4); //TODO: Assert that magic number is correct
-    makeLittleEndian(magic_number);
-    uint32_t labels = 0;
-    is.read((char*)&labels, 4);
-    makeLittleEndian(labels);
-    std::vector<uint8_t> data(labels);
-    is.read((char*)data.data(), data.size());
-    std::vector<std::vector<double>> normalized_data(data.size());
-    for (size_t i = 0; i < normalized_data.size(); ++i)
-        normalized_data[i] = classToVector(data[i], 10);
-    return normalized_data;
-}
-
 int main()
 {
     NeuralNetwork net;
 
-    std::vector<std::vector<double>> inputs;
-    std::vector<std::vector<double>> labels;
-
-    std::vector<std::vector<double>> input_tests;
-    std::vector<std::vector<double>> label_tests;
+    std::function<void()> train;
+    std::function<double()> test;
 
     size_t epochs = 1;
 
 #if 0
-    net.add(DenseLayer(784));
-    net.add(DenseLayer<Relu>(16));
-    net.add(DenseLayer<Sigmoid>(10));
-
-    inputs = loadImages("data/mnist.input");
-    labels = loadLabels("data/mnist.label");
-
-    input_tests = loadImages("data/mnist-test.input");
-    label_tests = loadLabels("data/mnist-test.label");
+    net.add(784);
+    net.add<Relu>(16);
+    net.add<Softmax>(10);
+    net.setLoss<SoftmaxCrossEntropy>();
+
+    // Images stay memory-mapped and are binarized while batches are filled
+    IdxDataset train_set("data/mnist.input", "data/mnist.label");
+    IdxDataset test_set("data/mnist-test.input", "data/mnist-test.label");
+    train_set.setThreshold(128);
+    test_set.setThreshold(128);
+
+    train = [&]
+    {
+        BatchPipeline pipeline(train_set, net.getBatchSize(), epochs, Random::seed);
+        net.train(pipeline);
+        auto stats = pipeline.getStats();
+        std::cout << "Waited for " << stats.trainer_waits << " of " << stats.batches << " batches\n";
+    };
+    test = [&] { return net.test(test_set); };
 #else
     epochs = 5000;
 
@@ -158,16 +102,21 @@ int main()
     net.add<Relu>(2);
     net.add<Linear>(1);
 
-    inputs = { { 0, 0 }, { 0, 1 }, { 1, 0 }, { 1, 1 } };
-    labels = { { 0 }, { 1 }, { 1 }, { 0 } };
+    std::vector<std::vector<Scalar>> inputs = { { 0, 0 }, { 0, 1 }, { 1, 0 }, { 1, 1 } };
+    std::vector<std::vector<Scalar>> labels = { { 0 }, { 1 }, { 1 }, { 0 } };
 
+    std::vector<std::vector<Scalar>> input_tests;
+    std::vector<std::vector<Scalar>> label_tests;
     for (size_t i = 0; i < 1000; ++i)
     {
         bool x = Random::Bool();
         bool y = Random::Bool();
-        input_tests.push_back({ (double)x, (double)y });
-        label_tests.push_back({ double(x ^ y) });
+        input_tests.push_back({ (Scalar)x, (Scalar)y });
+        label_tests.push_back({ Scalar(x ^ y) });
     }
+
+    train = [&] { net.train(inputs, labels, epochs); };
+    test = [&] { return net.test(input_tests, label_tests); };
 #endif
         //-0.68, 0.68     -0.84,  0.84
         //-0.1, -0.02      0.84, -0.84
@@ -179,12 +128,19 @@ int main()
     net.setOptimizer<Gd>(0.101);
 
     DebugTimer t;
-    net.train(inputs, labels, epochs);
+    train();
     t.stop();
 
-    double result = net.test(input_tests, label_tests);
+    double result = test();
     std::cout << "Loss: " << result << '\n';
 
+    if (Profiler::enabled)
+    {
+        std::ofstream trace("trace.json");
+        Profiler::get().writeTrace(trace);
+        Profiler::get().writeSummary(std::cout);
+    }
+
 
 
     return 0;
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include "scalar.h"
+
+// Every parameter buffer starts on its own cache line
+inline constexpr size_t MATRIX_ALIGNMENT = 64;
+
+template <typename T>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(MATRIX_ALIGNMENT)));
+    }
+    void deallocate(T* ptr, size_t)
+    {
+        ::operator delete(ptr, std::align_val_t(MATRIX_ALIGNMENT));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const
+    {
+        return true;
+    }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Non-owning row-major view, rows are indexed as view[row][col]
+template <typename T>
+struct MatrixView
+{
+    MatrixView() = default;
+    MatrixView(T* data, size_t rows, size_t cols)
+        : data(data), rows(rows), cols(cols)
+    {}
+
+    operator MatrixView<const T>() const
+    {
+        return { data, rows, cols };
+    }
+
+    T* operator[](size_t row) const
+    {
+        return data + row * cols;
+    }
+    size_t size() const
+    {
+        return rows * cols;
+    }
+
+    T* data = nullptr;
+    size_t rows = 0;
+    size_t cols = 0;
+};
+
+// Owning row-major matrix stored in a single aligned buffer
+template <typename T>
+struct BasicMatrix
+{
+    BasicMatrix() = default;
+    BasicMatrix(size_t rows, size_t cols, T value = T())
+        : rows(rows), cols(cols), values(rows * cols, value)
+    {}
+
+    void resize(size_t new_rows, size_t new_cols)
+    {
+        rows = new_rows;
+        cols = new_cols;
+        values.resize(rows * cols);
+    }
+    void fill(T value)
+    {
+        std::fill(values.begin(), values.end(), value);
+    }
+
+    T* operator[](size_t row)
+    {
+        return values.data() + row * cols;
+    }
+    const T* operator[](size_t row) const
+    {
+        return values.data() + row * cols;
+    }
+
+    T* data()
+    {
+        return values.data();
+    }
+    const T* data() const
+    {
+        return values.data();
+    }
+    size_t size() const
+    {
+        return values.size();
+    }
+
+    MatrixView<T> view()
+    {
+        return { values.data(), rows, cols };
+    }
+    MatrixView<const T> view() const
+    {
+        return { values.data(), rows, cols };
+    }
+
+    size_t rows = 0;
+    size_t cols = 0;
+    AlignedVector<T> values;
+};
+
+using Matrix = BasicMatrix<Scalar>;
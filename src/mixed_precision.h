@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include "matrix.h"
+
+// Upper half of an IEEE float: the same 8 bit exponent and range, with an
+// 8 bit mantissa. Emulated in software, values are only stored this way and
+// widened to Scalar for every computation.
+struct BFloat16
+{
+    uint16_t bits = 0;
+};
+
+// Rounds to the nearest even through float, NaN stays NaN. Branch free, so
+// the array versions vectorize.
+inline BFloat16 toBFloat16(Scalar value)
+{
+    const float single = (float)value;
+    uint32_t bits;
+    std::memcpy(&bits, &single, sizeof(bits));
+    const uint32_t rounded = bits + 0x7fff + ((bits >> 16) & 1);
+    const uint32_t quiet_nan = bits | 0x400000;
+    return { uint16_t(((bits & 0x7fffffff) > 0x7f800000 ? quiet_nan : rounded) >> 16) };
+}
+
+inline Scalar toScalar(BFloat16 value)
+{
+    const uint32_t bits = uint32_t(value.bits) << 16;
+    float single;
+    std::memcpy(&single, &bits, sizeof(single));
+    return single;
+}
+
+inline void toBFloat16(const Scalar* values, BFloat16* results, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        results[i] = toBFloat16(values[i]);
+}
+
+inline void toScalar(const BFloat16* values, Scalar* results, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        results[i] = toScalar(values[i]);
+}
+
+using HalfMatrix = BasicMatrix<BFloat16>;
+
+// Activations a mixed-precision forward pass keeps for the backward pass
+// and the errors passed between layers, see NeuralNetwork::setMixedPrecision
+struct HalfLayerBatch
+{
+    HalfMatrix neurons;
+    HalfMatrix activated_neurons;
+    HalfMatrix neuron_errors;
+};
+
+// Dynamic loss scaling for mixed-precision training. The output errors are
+// multiplied by scale before they are stored in bfloat16, so that small
+// errors deep in the network do not flush to zero, and the gradients are
+// divided by it again before the optimizer step. A step with non-finite
+// gradients is skipped and shrinks the scale, growth_interval good steps in
+// a row grow it.
+struct LossScaler
+{
+    // Called once per step, returns whether the step may be taken
+    bool update(bool finite_gradients)
+    {
+        if (!finite_gradients)
+        {
+            scale *= backoff_factor;
+            good_steps = 0;
+            ++skipped_steps;
+            return false;
+        }
+        if (++good_steps == growth_interval)
+        {
+            scale *= growth_factor;
+            good_steps = 0;
+        }
+        return true;
+    }
+
+    // Powers of two keep the scaling exact
+    double scale = 65536;
+    double growth_factor = 2;
+    double backoff_factor = 0.5;
+    size_t growth_interval = 2000;
+
+    size_t good_steps = 0;
+    size_t skipped_steps = 0;
+};
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include "model_file.h"
+#include "neural_network.h"
+#include "checksum.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+
+static constexpr char MODEL_MAGIC[8] = { 'N', 'N', 'M', 'O', 'D', 'E', 'L', '\0' };
+
+static uint64_t alignOffset(uint64_t offset, uint64_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+void ModelFile::save(const NeuralNetwork& net, const std::string& path)
+{
+    const size_t layer_count = net.getLayerCount();
+
+    // Activation parameters go to the table area, padded to whole words
+    std::vector<std::string> activations(layer_count);
+    for (size_t layer = 0; layer < layer_count; ++layer)
+    {
+        std::ostringstream os(std::ios::binary);
+        os << *net.layers[layer].activation;
+        activations[layer] = os.str();
+    }
+
+    std::vector<LayerRecord> records(layer_count);
+    uint64_t offset = sizeof(ModelHeader) + layer_count * sizeof(LayerRecord);
+    for (size_t layer = 0; layer < layer_count; ++layer)
+    {
+        const Layer& l = net.layers[layer];
+        records[layer] = { l.size, l.input_size, 0, 0, offset, (uint32_t)activations[layer].size(), l.activation->type, {} };
+        offset += alignOffset(activations[layer].size(), 8);
+    }
+    const uint64_t table_end = offset;
+    const uint64_t data_offset = alignOffset(table_end, TENSOR_ALIGNMENT);
+    offset = data_offset;
+    for (size_t layer = 1; layer < layer_count; ++layer)
+    {
+        const Layer& l = net.layers[layer];
+        records[layer].weights_offset = offset;
+        offset = alignOffset(offset + l.weights.size() * sizeof(Scalar), TENSOR_ALIGNMENT);
+        records[layer].biases_offset = offset;
+        offset = alignOffset(offset + l.biases.size() * sizeof(Scalar), TENSOR_ALIGNMENT);
+    }
+
+    ModelHeader header = {};
+    std::memcpy(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+    header.version = VERSION;
+    header.layer_count = (uint32_t)layer_count;
+    header.precision = SCALAR_PRECISION;
+    header.data_offset = data_offset;
+    header.file_size = offset;
+
+    // Tensors are written in the order of their offsets, each padded with
+    // zeros up to the next one, so the same bytes can be hashed beforehand
+    static constexpr char padding[TENSOR_ALIGNMENT] = {};
+    auto forEachTensor = [&](auto&& write)
+    {
+        for (size_t layer = 1; layer < layer_count; ++layer)
+        {
+            const Layer& l = net.layers[layer];
+            const size_t weight_bytes = l.weights.size() * sizeof(Scalar);
+            const size_t bias_bytes = l.biases.size() * sizeof(Scalar);
+            write(l.weights.data(), weight_bytes);
+            write(padding, records[layer].biases_offset - records[layer].weights_offset - weight_bytes);
+            write(l.biases.data(), bias_bytes);
+            const uint64_t next = layer + 1 < layer_count ? records[layer + 1].weights_offset : header.file_size;
+            write(padding, next - records[layer].biases_offset - bias_bytes);
+        }
+    };
+
+    Checksum data_checksum;
+    forEachTensor([&](const void* data, size_t size) { data_checksum.update(data, size); });
+    header.data_checksum = data_checksum.finish();
+
+    Checksum table_checksum;
+    table_checksum.update(&header, offsetof(ModelHeader, table_checksum));
+    table_checksum.update(records.data(), records.size() * sizeof(LayerRecord));
+    for (const auto& activation : activations)
+    {
+        table_checksum.update(activation.data(), activation.size());
+        table_checksum.update(padding, alignOffset(activation.size(), 8) - activation.size());
+    }
+    table_checksum.update(padding, data_offset - table_end);
+    header.table_checksum = table_checksum.finish();
+
+    std::ofstream os(path, std::ios::binary);
+    if (!os)
+        throw std::runtime_error("Cannot create " + path);
+    os.write((const char*)&header, sizeof(header));
+    os.write((const char*)records.data(), records.size() * sizeof(LayerRecord));
+    for (const auto& activation : activations)
+    {
+        os.write(activation.data(), activation.size());
+        os.write(padding, alignOffset(activation.size(), 8) - activation.size());
+    }
+    os.write(padding, data_offset - table_end);
+    forEachTensor([&](const void* data, size_t size) { os.write((const char*)data, size); });
+    if (!os)
+        throw std::runtime_error("Cannot write " + path);
+}
+
+ModelFile::ModelFile(const std::string& path, bool verify_data)
+    : file(path)
+{
+    if (file.size() < sizeof(ModelHeader) || std::memcmp(header().magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0)
+        throw std::runtime_error(path + " is not a model file");
+    if (header().version != VERSION)
+        throw std::runtime_error(path + " has unsupported version " + std::to_string(header().version));
+    if (header().file_size != file.size() || header().data_offset > file.size() ||
+        sizeof(ModelHeader) + getLayerCount() * sizeof(LayerRecord) > header().data_offset)
+        throw std::runtime_error(path + " is truncated");
+
+    Checksum table_checksum;
+    table_checksum.update(file.data(), offsetof(ModelHeader, table_checksum));
+    table_checksum.update(file.data() + sizeof(ModelHeader), header().data_offset - sizeof(ModelHeader));
+    if (table_checksum.finish() != header().table_checksum)
+        throw std::runtime_error(path + " has a corrupted layer table");
+
+    const size_t scalar_size = getPrecision() == Precision::FLOAT32 ? sizeof(float) : sizeof(double);
+    for (size_t layer = 0; layer < getLayerCount(); ++layer)
+    {
+        const LayerRecord& record = getLayer(layer);
+        if (record.activation_offset + record.activation_bytes > header().data_offset)
+            throw std::runtime_error(path + " has an invalid layer " + std::to_string(layer));
+        if (layer == 0)
+            continue;
+        if (record.input_size != getLayer(layer - 1).size ||
+            record.weights_offset + record.size * record.input_size * scalar_size > file.size() ||
+            record.biases_offset + record.size * scalar_size > file.size() ||
+            record.weights_offset % TENSOR_ALIGNMENT || record.biases_offset % TENSOR_ALIGNMENT)
+            throw std::runtime_error(path + " has an invalid layer " + std::to_string(layer));
+    }
+
+    if (verify_data && !verifyData())
+        throw std::runtime_error(path + " has corrupted weights");
+}
+
+bool ModelFile::verifyData() const
+{
+    Checksum data_checksum;
+    data_checksum.update(file.data() + header().data_offset, file.size() - header().data_offset);
+    return data_checksum.finish() == header().data_checksum;
+}
+
+std::shared_ptr<Activation> ModelFile::buildActivation(size_t layer) const
+{
+    const LayerRecord& record = getLayer(layer);
+    auto activation = ActivationFactory::build(record.activation_type);
+    if (!activation)
+        throw std::runtime_error("Unknown activation in model file");
+    std::istringstream is(std::string((const char*)file.data() + record.activation_offset, record.activation_bytes), std::ios::binary);
+    is >> *activation;
+    return activation;
+}
+
+void ModelFile::readTensor(uint64_t offset, Scalar* values, size_t count) const
+{
+    const uint8_t* bytes = file.data() + offset;
+    if (isMappable())
+    {
+        std::memcpy(values, bytes, count * sizeof(Scalar));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (getPrecision() == Precision::FLOAT32)
+            values[i] = (Scalar)((const float*)bytes)[i];
+        else
+            values[i] = (Scalar)((const double*)bytes)[i];
+    }
+}
+
+void ModelFile::load(NeuralNetwork& net) const
+{
+    net.layers.clear();
+    for (size_t layer = 0; layer < getLayerCount(); ++layer)
+    {
+        const LayerRecord& record = getLayer(layer);
+        net.layers.push_back(Layer(net, layer, record.input_size, record.size, buildActivation(layer)));
+        if (layer)
+        {
+            readTensor(record.weights_offset, net.layers.back().weights.data(), net.layers.back().weights.size());
+            readTensor(record.biases_offset, net.layers.back().biases.data(), net.layers.back().biases.size());
+        }
+    }
+    if (net.optimizer)
+        net.optimizer->build();
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <span>
+#include "activations.h"
+#include "dataset.h"
+
+class NeuralNetwork;
+
+// Versioned model container laid out for memory mapping:
+//
+//   ModelHeader                     64 bytes
+//   LayerRecord[layer_count]        48 bytes each
+//   activation parameters           padded to 8 bytes each
+//   weights and biases              every tensor at a 64 byte aligned offset
+//
+// All fields are little-endian. The table checksum covers the header fields
+// before it, the layer records and the activation parameters and is always
+// verified. The data checksum covers everything from data_offset to the end
+// of the file and is only verified on request, since that reads every page.
+struct ModelHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t layer_count;
+    Precision precision;
+    uint8_t reserved[15];
+    uint64_t data_offset;
+    uint64_t file_size;
+    uint64_t table_checksum;
+    uint64_t data_checksum;
+};
+static_assert(sizeof(ModelHeader) == 64);
+
+struct LayerRecord
+{
+    uint64_t size;
+    uint64_t input_size;
+    // Offsets from the start of the file, 0 for the input layer
+    uint64_t weights_offset;
+    uint64_t biases_offset;
+    uint64_t activation_offset;
+    uint32_t activation_bytes;
+    Activation::Type activation_type;
+    uint8_t reserved[3];
+};
+static_assert(sizeof(LayerRecord) == 48);
+
+// Read-only view of a model file mapped into memory. Tensors saved with the
+// build's precision can be used in place, so loading does not copy weights
+// and processes mapping the same file share it through the page cache.
+class ModelFile
+{
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t TENSOR_ALIGNMENT = 64;
+
+    // Throws std::runtime_error if the file is not a model of a known
+    // version, is truncated or fails a checksum
+    explicit ModelFile(const std::string& path, bool verify_data = false);
+
+    static void save(const NeuralNetwork& net, const std::string& path);
+
+    // Copies the layers into net, converting precision if needed. The
+    // optimizer, if one is set, is resized to the loaded layers.
+    void load(NeuralNetwork& net) const;
+
+    bool verifyData() const;
+
+    size_t getLayerCount() const
+    {
+        return header().layer_count;
+    }
+    Precision getPrecision() const
+    {
+        return header().precision;
+    }
+    const LayerRecord& getLayer(size_t layer) const
+    {
+        return records()[layer];
+    }
+    std::shared_ptr<Activation> buildActivation(size_t layer) const;
+
+    // Tensors in place, only when the file has the build's precision
+    bool isMappable() const
+    {
+        return getPrecision() == SCALAR_PRECISION;
+    }
+    const Scalar* getWeights(size_t layer) const
+    {
+        return (const Scalar*)(file.data() + getLayer(layer).weights_offset);
+    }
+    const Scalar* getBiases(size_t layer) const
+    {
+        return (const Scalar*)(file.data() + getLayer(layer).biases_offset);
+    }
+    // Copies a tensor converting it to Scalar
+    void readTensor(uint64_t offset, Scalar* values, size_t count) const;
+
+private:
+    const ModelHeader& header() const
+    {
+        return *(const ModelHeader*)file.data();
+    }
+    const LayerRecord* records() const
+    {
+        return (const LayerRecord*)(file.data() + sizeof(ModelHeader));
+    }
+
+private:
+    MappedFile file;
+};
\ No newline at end of file
@@ -1,69 +1,733 @@
 #include "neural_network.h"
 #include "random.h"
+#include "kernels.h"
+#include <cmath>
+#include <atomic>
+#include <mutex>
 
-void NeuralNetwork::forward(const std::vector<double> &inputs)
+void NeuralNetwork::forward(const std::vector<Scalar> &inputs)
 {
-    layers.front().activated_neurons = inputs;
+    layers.front().activated_neurons.assign(inputs.begin(), inputs.end());
 
     for (size_t layer = 1; layer < layers.size(); ++layer)
         layers[layer].forward();
 }
-void NeuralNetwork::backpropagate(const std::vector<double> &targets, size_t iteration)
+void NeuralNetwork::backpropagate(const std::vector<Scalar> &targets, size_t iteration)
 {
     calculateGradient(targets);
     optimize(iteration);
 }
 
-void NeuralNetwork::calculateGradient(const std::vector<double> &targets)
+void NeuralNetwork::calculateGradient(const std::vector<Scalar> &targets)
 {
-    for (size_t neuron = 0; neuron < layers.back().size; ++neuron)
-        layers.back().neuron_errors[neuron] = (targets[neuron] - layers.back().activated_neurons[neuron]) * layers.back().activation->derivative(layers.back().neurons[neuron]);
+    NN_PROFILE_SCOPE("calculate_gradient");
+    auto& output_layer = layers.back();
+    loss->outputErrors(*output_layer.activation, output_layer.neurons, output_layer.activated_neurons, targets, output_layer.neuron_errors);
 
     for (size_t layer = layers.size() - 1; layer >= 1; --layer)
+    {
         layers[layer].calculateGradients(targets);
+        gradientsReady(layer);
+    }
 }
 
-void NeuralNetwork::optimize(size_t iteration)
+void NeuralNetwork::forwardBatch(MatrixView<const Scalar> inputs)
 {
-    (*optimizer)(iteration);
+    forwardBatch(inputs, workspace);
+}
+
+void NeuralNetwork::backwardBatch(MatrixView<const Scalar> targets)
+{
+    auto& batches = workspace.batches;
+    calculateOutputErrors(targets, batches.back());
+    for (size_t layer = layers.size() - 1; layer >= 1; --layer)
+    {
+        layers[layer].backwardBatch(batches[layer - 1], batches[layer]);
+        gradientsReady(layer);
+    }
+}
+
+void NeuralNetwork::forwardBatch(MatrixView<const Scalar> inputs, Workspace& workspace) const
+{
+    auto& batches = workspace.batches;
+    batches.resize(layers.size());
+    for (size_t layer = 0; layer < layers.size(); ++layer)
+        batches[layer].resize(inputs.rows, layers[layer].size);
+
+    std::copy(inputs.data, inputs.data + inputs.size(), batches.front().activated_neurons.data());
+
+    for (size_t layer = 1; layer < layers.size(); ++layer)
+        layers[layer].forwardBatch(batches[layer - 1], batches[layer]);
+}
+
+std::span<const Scalar> NeuralNetwork::predict(std::span<const Scalar> inputs, Workspace& workspace) const
+{
+    forwardBatch({ inputs.data(), 1, inputs.size() }, workspace);
+    return { workspace.batches.back().activated_neurons.data(), getOutputCount() };
+}
+
+void NeuralNetwork::prepareGradients(Workspace& workspace) const
+{
+    if (workspace.delta_weights.size() != layers.size())
+    {
+        workspace.delta_weights.resize(layers.size());
+        workspace.delta_biases.resize(layers.size());
+        for (size_t layer = 1; layer < layers.size(); ++layer)
+        {
+            workspace.delta_weights[layer].resize(layers[layer].size, layers[layer].input_size);
+            workspace.delta_biases[layer].resize(layers[layer].size);
+        }
+    }
+}
+
+void NeuralNetwork::backwardBatch(MatrixView<const Scalar> targets, Workspace& workspace) const
+{
+    auto& batches = workspace.batches;
+    prepareGradients(workspace);
+
+    calculateOutputErrors(targets, batches.back());
+    for (size_t layer = layers.size() - 1; layer >= 1; --layer)
+    {
+        layers[layer].backwardBatch(batches[layer - 1], batches[layer], workspace.delta_weights[layer].view(), workspace.delta_biases[layer]);
+        if (workspace.layer_done)
+            workspace.layer_done(layer);
+    }
+}
+
+void NeuralNetwork::setCheckpoints(std::vector<size_t> layers)
+{
+    std::sort(layers.begin(), layers.end());
+    layers.erase(std::unique(layers.begin(), layers.end()), layers.end());
+    checkpoints = std::move(layers);
+}
+
+std::vector<size_t> NeuralNetwork::segmentBounds(const std::vector<size_t>& layers) const
+{
+    std::vector<size_t> bounds = { 0 };
+    for (size_t layer : layers)
+        if (layer > 0 && layer + 1 < this->layers.size())
+            bounds.push_back(layer);
+    bounds.push_back(this->layers.size() - 1);
+    return bounds;
+}
+
+void NeuralNetwork::trainingForward(MatrixView<const Scalar> inputs, Workspace& workspace) const
+{
+    if (mixed_precision)
+        return mixedForward(inputs, workspace);
+    if (checkpoints.empty())
+        return forwardBatch(inputs, workspace);
+
+    // Layers between two checkpoints go to the segment buffers the backward
+    // pass recomputes them into, only the checkpoints stay in batches
+    const std::vector<size_t> bounds = segmentBounds(checkpoints);
+    for (size_t i = 1; i < bounds.size(); ++i)
+        if (workspace.segment.size() < bounds[i] - bounds[i - 1] - 1)
+            workspace.segment.resize(bounds[i] - bounds[i - 1] - 1);
+    auto& batches = workspace.batches;
+    batches.resize(layers.size());
+    batches.front().resize(inputs.rows, getInputCount());
+    std::copy(inputs.data, inputs.data + inputs.size(), batches.front().activated_neurons.data());
+
+    const LayerBatch* prev_batch = &batches.front();
+    size_t segment = 1;
+    for (size_t layer = 1; layer < layers.size(); ++layer)
+    {
+        LayerBatch* batch = &batches[layer];
+        if (layer == bounds[segment])
+        {
+            ++segment;
+        }
+        else
+        {
+            // Memory of a previous full pass is given back
+            *batch = LayerBatch();
+            batch = &workspace.segment[layer - bounds[segment - 1] - 1];
+        }
+        batch->resize(inputs.rows, layers[layer].size);
+        layers[layer].forwardBatch(*prev_batch, *batch);
+        prev_batch = batch;
+    }
+}
+
+void NeuralNetwork::trainingBackward(MatrixView<const Scalar> targets, Workspace& workspace) const
+{
+    if (mixed_precision)
+        return mixedBackward(targets, workspace);
+    if (checkpoints.empty())
+        return backwardBatch(targets, workspace);
+
+    const std::vector<size_t> bounds = segmentBounds(checkpoints);
+    auto& batches = workspace.batches;
+    prepareGradients(workspace);
+    calculateOutputErrors(targets, batches.back());
 
+    // Segments from the last one, each recomputed from its first checkpoint.
+    // The last one was computed last by the forward pass and is still in the
+    // segment buffers. The backward pass of a segment leaves the errors of
+    // that checkpoint for the segment before it.
+    const size_t rows = targets.rows;
+    for (size_t segment = bounds.size() - 1; segment >= 1; --segment)
+    {
+        const size_t first = bounds[segment - 1];
+        const size_t last = bounds[segment];
+        auto batchOf = [&](size_t layer) -> LayerBatch&
+        {
+            return layer == first || layer == last ? batches[layer] : workspace.segment[layer - first - 1];
+        };
+
+        if (segment + 1 < bounds.size())
+        {
+            for (size_t layer = first + 1; layer < last; ++layer)
+            {
+                batchOf(layer).resize(rows, layers[layer].size);
+                layers[layer].forwardBatch(batchOf(layer - 1), batchOf(layer));
+            }
+        }
+        for (size_t layer = last; layer > first; --layer)
+        {
+            layers[layer].backwardBatch(batchOf(layer - 1), batchOf(layer), workspace.delta_weights[layer].view(), workspace.delta_biases[layer]);
+            if (workspace.layer_done)
+                workspace.layer_done(layer);
+        }
+    }
+}
+
+size_t NeuralNetwork::getActivationMemory(size_t batch_size, const std::vector<size_t>& layers) const
+{
+    // Follows the buffers of the checkpointed passes, which keep the
+    // capacity of the largest layer they ever held
+    auto bytes = [&](size_t layer)
+    {
+        return 3 * batch_size * this->layers[layer].size * sizeof(Scalar);
+    };
+    size_t total = 0;
+    if (layers.empty())
+    {
+        for (size_t layer = 0; layer < this->layers.size(); ++layer)
+            total += bytes(layer);
+        return total;
+    }
+
+    // Segment buffer i holds the i-th layer after a checkpoint
+    const std::vector<size_t> bounds = segmentBounds(layers);
+    std::vector<size_t> segment;
+    for (size_t i = 0; i < bounds.size(); ++i)
+        total += bytes(bounds[i]);
+    for (size_t i = 1; i < bounds.size(); ++i)
+    {
+        for (size_t layer = bounds[i - 1] + 1; layer < bounds[i]; ++layer)
+        {
+            const size_t slot = layer - bounds[i - 1] - 1;
+            if (slot >= segment.size())
+                segment.resize(slot + 1, 0);
+            segment[slot] = std::max(segment[slot], bytes(layer));
+        }
+    }
+    for (size_t slot_bytes : segment)
+        total += slot_bytes;
+    return total;
+}
+
+void NeuralNetwork::mixedForward(MatrixView<const Scalar> inputs, Workspace& workspace) const
+{
+    auto& half_batches = workspace.half_batches;
+    half_batches.resize(layers.size());
+    half_batches.front().activated_neurons.resize(inputs.rows, getInputCount());
+    toBFloat16(inputs.data, half_batches.front().activated_neurons.data(), inputs.size());
+
+    // Hidden layers are computed into the scratch and stored rounded, the
+    // output layer stays in Scalar for the loss
+    workspace.batches.resize(layers.size());
     for (size_t layer = 1; layer < layers.size(); ++layer)
-        for (size_t neuron = 0; neuron < layers[layer].size; ++neuron)
+    {
+        const bool output = layer + 1 == layers.size();
+        LayerBatch& batch = output ? workspace.batches.back() : workspace.scratch;
+        batch.resize(inputs.rows, layers[layer].size);
+        layers[layer].forwardBatch(half_batches[layer - 1], batch);
+        if (output)
+            break;
+        HalfLayerBatch& half_batch = half_batches[layer];
+        half_batch.neurons.resize(inputs.rows, layers[layer].size);
+        half_batch.activated_neurons.resize(inputs.rows, layers[layer].size);
+        toBFloat16(batch.neurons.data(), half_batch.neurons.data(), batch.neurons.size());
+        toBFloat16(batch.activated_neurons.data(), half_batch.activated_neurons.data(), batch.activated_neurons.size());
+    }
+}
+
+void NeuralNetwork::mixedBackward(MatrixView<const Scalar> targets, Workspace& workspace) const
+{
+    auto& half_batches = workspace.half_batches;
+    prepareGradients(workspace);
+    LayerBatch& output = workspace.batches.back();
+    calculateOutputErrors(targets, output);
+
+    // Scaled before rounding, unscaleGradients takes the scale out again
+    const Scalar scale = (Scalar)loss_scaler.scale;
+    HalfMatrix& output_errors = half_batches.back().neuron_errors;
+    output_errors.resize(targets.rows, getOutputCount());
+    for (size_t i = 0; i < output_errors.size(); ++i)
+        output_errors.data()[i] = toBFloat16(output.neuron_errors.data()[i] * scale);
+
+    for (size_t layer = layers.size() - 1; layer >= 1; --layer)
+    {
+        layers[layer].backwardBatch(half_batches[layer - 1], half_batches[layer], workspace.scratch, workspace.delta_weights[layer].view(), workspace.delta_biases[layer]);
+        if (workspace.layer_done)
+            workspace.layer_done(layer);
+    }
+}
+
+bool NeuralNetwork::unscaleGradients()
+{
+    NN_PROFILE_SCOPE("unscale_gradients");
+    // Every process of a reducer sees the same sums and skips the same steps
+    if (reducer)
+        reducer->finish(*this);
+
+    const Scalar inverse_scale = Scalar(1 / loss_scaler.scale);
+    bool finite = true;
+    for (size_t layer = 1; layer < layers.size(); ++layer)
+    {
+        for (Scalar& delta : layers[layer].delta_weights.values)
+        {
+            delta *= inverse_scale;
+            finite &= std::isfinite(delta);
+        }
+        for (Scalar& delta : layers[layer].delta_biases)
+        {
+            delta *= inverse_scale;
+            finite &= std::isfinite(delta);
+        }
+    }
+    if (loss_scaler.update(finite))
+        return true;
+    for (size_t layer = 1; layer < layers.size(); ++layer)
+    {
+        layers[layer].delta_weights.fill(0.0);
+        std::fill(layers[layer].delta_biases.begin(), layers[layer].delta_biases.end(), 0.0);
+    }
+    return false;
+}
+
+std::vector<size_t> NeuralNetwork::planCheckpoints(size_t batch_size, size_t memory_budget) const
+{
+    if (getActivationMemory(batch_size, {}) <= memory_budget)
+        return {};
+
+    // Every layer between checkpoints is recomputed once, so a plan costs
+    // the forward FLOPs of the layers it does not keep, except those after
+    // the last checkpoint, which the forward pass leaves in the segment
+    // buffers for the backward pass. For every limit on
+    // the bytes between two checkpoints, layers are kept greedily only where
+    // the limit would be exceeded. The limits tried are the sizes of all
+    // runs of consecutive hidden layers.
+    const size_t hidden_end = layers.size() - 1;
+    auto bytes = [&](size_t layer)
+    {
+        return 3 * batch_size * layers[layer].size * sizeof(Scalar);
+    };
+    std::vector<size_t> limits;
+    for (size_t begin = 1; begin < hidden_end; ++begin)
+    {
+        size_t run = 0;
+        for (size_t end = begin; end < hidden_end; ++end)
+            limits.push_back(run += bytes(end));
+    }
+    limits.push_back(0);
+    std::sort(limits.begin(), limits.end());
+    limits.erase(std::unique(limits.begin(), limits.end()), limits.end());
+
+    std::vector<size_t> best;
+    double best_flops = -1;
+    size_t smallest = SIZE_MAX;
+    for (size_t limit : limits)
+    {
+        std::vector<size_t> plan;
+        size_t run = 0;
+        double run_flops = 0;
+        double recomputed_flops = 0;
+        for (size_t layer = 1; layer < hidden_end; ++layer)
+        {
+            if (run + bytes(layer) > limit)
+            {
+                plan.push_back(layer);
+                run = 0;
+                recomputed_flops += run_flops;
+                run_flops = 0;
+            }
+            else
+            {
+                run += bytes(layer);
+                run_flops += 2.0 * batch_size * layers[layer].weights.size();
+            }
+        }
+        const size_t memory = getActivationMemory(batch_size, plan);
+        smallest = std::min(smallest, memory);
+        if (memory <= memory_budget && (best_flops < 0 || recomputed_flops < best_flops))
         {
-            layers[layer].delta_biases[neuron] = 0.0;
-            for (size_t prev_neuron = 0; prev_neuron < layers[layer].input_size; ++prev_neuron)
-                layers[layer].delta_weights[neuron][prev_neuron] = 0.0;
+            best = std::move(plan);
+            best_flops = recomputed_flops;
         }
+    }
+    if (best_flops < 0)
+        throw std::invalid_argument("Activations need at least " + std::to_string(smallest) + " bytes for this batch size");
+    // Keeping no hidden layer at all is written { 0 }, as an empty list
+    // turns checkpointing off
+    return best.empty() ? std::vector<size_t>{ 0 } : best;
+}
+
+void NeuralNetwork::forwardBatch(const SparseBatch& inputs)
+{
+    forwardBatch(inputs, workspace);
+}
+
+void NeuralNetwork::backwardBatch(const SparseBatch& inputs, MatrixView<const Scalar> targets)
+{
+    auto& batches = workspace.batches;
+    calculateOutputErrors(targets, batches.back());
+    for (size_t layer = layers.size() - 1; layer >= 2; --layer)
+    {
+        layers[layer].backwardBatch(batches[layer - 1], batches[layer]);
+        gradientsReady(layer);
+    }
+    layers[1].backwardSparse(inputs, batches[1], layers[1].delta_weights.view(), layers[1].delta_biases);
+    gradientsReady(1);
+}
+
+void NeuralNetwork::forwardBatch(const SparseBatch& inputs, Workspace& workspace) const
+{
+    // The input layer's batch is never materialized
+    auto& batches = workspace.batches;
+    batches.resize(layers.size());
+    batches.front().resize(inputs.rows(), 0);
+    for (size_t layer = 1; layer < layers.size(); ++layer)
+        batches[layer].resize(inputs.rows(), layers[layer].size);
+
+    layers[1].forwardSparse(inputs, batches[1]);
+    for (size_t layer = 2; layer < layers.size(); ++layer)
+        layers[layer].forwardBatch(batches[layer - 1], batches[layer]);
+}
+
+void NeuralNetwork::backwardBatch(const SparseBatch& inputs, MatrixView<const Scalar> targets, Workspace& workspace) const
+{
+    auto& batches = workspace.batches;
+    prepareGradients(workspace);
+
+    calculateOutputErrors(targets, batches.back());
+    for (size_t layer = layers.size() - 1; layer >= 2; --layer)
+    {
+        layers[layer].backwardBatch(batches[layer - 1], batches[layer], workspace.delta_weights[layer].view(), workspace.delta_biases[layer]);
+        if (workspace.layer_done)
+            workspace.layer_done(layer);
+    }
+    layers[1].backwardSparse(inputs, batches[1], workspace.delta_weights[1].view(), workspace.delta_biases[1]);
+    if (workspace.layer_done)
+        workspace.layer_done(1);
 }
 
-void NeuralNetwork::train(const std::vector<double> &inputs, const std::vector<double> &targets, size_t iteration)
+void NeuralNetwork::calculateOutputErrors(MatrixView<const Scalar> targets, LayerBatch& output_batch) const
+{
+    loss->outputErrorsBatch(*layers.back().activation, output_batch.neurons.view(), output_batch.activated_neurons.view(), targets, output_batch.neuron_errors.view());
+}
+
+void NeuralNetwork::optimize(size_t iteration)
+{
+    NN_PROFILE_SCOPE("optimize");
+    if (reducer)
+        reducer->finish(*this);
+    // The optimizer clears the deltas as part of its update pass
+    (*optimizer)(iteration);
+    if (pruner)
+        pruner->update(*this, iteration);
+}
+
+void NeuralNetwork::optimize(size_t iteration, std::span<const uint32_t> active_inputs)
+{
+    // Other processes may have gradients for other inputs
+    if (reducer)
+        return optimize(iteration);
+    NN_PROFILE_SCOPE("optimize");
+    (*optimizer)(iteration, active_inputs);
+    if (pruner)
+    {
+        const Optimizer::ColumnRuns runs = Optimizer::columnRuns(active_inputs);
+        pruner->update(*this, iteration, &runs);
+    }
+}
+
+class NeuralNetwork::StepReduction
+{
+public:
+    StepReduction(NeuralNetwork& net, std::span<const Workspace> workers, const std::vector<uint32_t>* first_layer_columns = nullptr)
+        : net(net), workers(workers), first_layer_columns(first_layer_columns),
+          pending(net.layers.size()), reduced(net.layers.size(), false), next(net.layers.size() - 1)
+    {
+        for (auto& count : pending)
+            count.store(workers.size(), std::memory_order_relaxed);
+    }
+
+    // Called by every worker for every layer. The last worker to be done
+    // with a layer sums it over all of them, on the pool, and the summed
+    // layers go to the gradient reducer from the output down, the order
+    // every process of the reducer relies on.
+    void layerDone(size_t layer)
+    {
+        if (pending[layer].fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        parallelFor(net.pool.get(), workers.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t slice = begin; slice < end; ++slice)
+                net.reduceLayer(workers, layer, slice, workers.size(), first_layer_columns);
+        });
+        std::lock_guard lock(mutex);
+        reduced[layer] = true;
+        for (; next >= 1 && reduced[next]; --next)
+            net.gradientsReady(next);
+    }
+
+private:
+    NeuralNetwork& net;
+    const std::span<const Workspace> workers;
+    const std::vector<uint32_t>* first_layer_columns;
+    // Workers still computing every layer's gradients
+    std::vector<std::atomic<size_t>> pending;
+    std::vector<bool> reduced;
+    // Next layer to hand to the gradient reducer
+    size_t next;
+    std::mutex mutex;
+};
+
+void NeuralNetwork::train(const std::vector<Scalar> &inputs, const std::vector<Scalar> &targets, size_t iteration)
 {
     forward(inputs);
     backpropagate(targets, iteration);
 }
-void NeuralNetwork::train(std::vector<std::vector<double>> &inputs, std::vector<std::vector<double>> &targets, size_t epochs)
+void NeuralNetwork::train(std::vector<std::vector<Scalar>> &inputs, std::vector<std::vector<Scalar>> &targets, size_t epochs)
 {
+    train(inputs.size(), [&](size_t first, MatrixView<Scalar> input_batch, MatrixView<Scalar> target_batch)
+    {
+        for (size_t sample = 0; sample < input_batch.rows; ++sample)
+        {
+            std::copy(inputs[first + sample].begin(), inputs[first + sample].end(), input_batch[sample]);
+            std::copy(targets[first + sample].begin(), targets[first + sample].end(), target_batch[sample]);
+        }
+    }, epochs);
+}
+void NeuralNetwork::train(size_t sample_count, const BatchFiller& fill, size_t epochs)
+{
+    // Every worker owns a contiguous shard of the samples and private
+    // gradients, the fixed shard boundaries and reduction order keep the
+    // result identical between runs with the same thread count
+    const size_t worker_count = getThreadCount();
+    workers.resize(worker_count);
     for (size_t epoch = 0; epoch < epochs; ++epoch)
     {
-        for (size_t i = 0; i < inputs.size(); ++i)
+        NN_PROFILE_SCOPE("epoch");
+        if (worker_count == 1)
+        {
+            // The optimizer leaves the layers' gradients cleared, so a single
+            // worker borrows them and nothing is cleared or reduced. Each
+            // layer's are given back as soon as they are complete.
+            Workspace& worker = workers.front();
+            for (size_t layer = 1; layer < layers.size(); ++layer)
+                swapGradients(worker, layer);
+            accumulateGradients(fill, 0, sample_count, worker, [&](size_t layer)
+            {
+                swapGradients(worker, layer);
+                gradientsReady(layer);
+            });
+        }
+        else
+        {
+            StepReduction reduction(*this, workers);
+            parallelFor(pool.get(), worker_count, 1, [&](size_t begin, size_t end)
+            {
+                for (size_t worker = begin; worker < end; ++worker)
+                {
+                    clearGradients(workers[worker]);
+                    accumulateGradients(fill, sample_count * worker / worker_count, sample_count * (worker + 1) / worker_count, workers[worker],
+                                        [&](size_t layer) { reduction.layerDone(layer); });
+                }
+            });
+        }
+
+        if (!mixed_precision || unscaleGradients())
+            optimize(epoch + 1);
+    }
+}
+void NeuralNetwork::train(const IdxDataset& dataset, size_t epochs)
+{
+    train(dataset.size(), [&](size_t first, MatrixView<Scalar> inputs, MatrixView<Scalar> targets)
+    {
+        dataset.fillBatch(first, inputs, targets);
+    }, epochs);
+}
+
+void NeuralNetwork::train(BatchPipeline& pipeline)
+{
+    size_t iteration = 0;
+    while (const BatchPipeline::Batch* batch = pipeline.next())
+        trainBatch(batch->inputs.view(), batch->targets.view(), ++iteration);
+}
+
+void NeuralNetwork::trainBatch(MatrixView<const Scalar> inputs, MatrixView<const Scalar> targets, size_t iteration)
+{
+    NN_PROFILE_SCOPE("train_batch");
+    // Rows of the batch are sharded like the samples of a full-batch epoch
+    const size_t worker_count = std::min(getThreadCount(), inputs.rows);
+    // An empty batch still hands every layer to the gradient reducer, the
+    // other processes wait for its share of the sums
+    if (worker_count == 0)
+        for (size_t layer = layers.size() - 1; layer >= 1; --layer)
+            gradientsReady(layer);
+    workers.resize(std::max(workers.size(), worker_count));
+    StepReduction reduction(*this, { workers.data(), worker_count });
+    parallelFor(pool.get(), worker_count, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t worker = begin; worker < end; ++worker)
+        {
+            const size_t first = inputs.rows * worker / worker_count;
+            const size_t count = inputs.rows * (worker + 1) / worker_count - first;
+            Workspace& workspace = workers[worker];
+            clearGradients(workspace);
+            trainingForward({ inputs[first], count, inputs.cols }, workspace);
+            workspace.layer_done = [&](size_t layer) { reduction.layerDone(layer); };
+            trainingBackward({ targets[first], count, targets.cols }, workspace);
+            workspace.layer_done = nullptr;
+        }
+    });
+
+    if (!mixed_precision || unscaleGradients())
+        optimize(iteration);
+}
+
+void NeuralNetwork::trainBatch(const SparseBatch& inputs, MatrixView<const Scalar> targets, size_t iteration)
+{
+    NN_PROFILE_SCOPE("train_sparse_batch");
+    const std::vector<uint32_t> columns = inputs.activeColumns();
+
+    const size_t worker_count = std::min(getThreadCount(), inputs.rows());
+    if (worker_count <= 1)
+    {
+        // The optimizer leaves the layers' gradients cleared, so a single
+        // worker accumulates into them directly and nothing is reduced
+        forwardBatch(inputs);
+        backwardBatch(inputs, targets);
+        optimize(iteration, columns);
+        return;
+    }
+    workers.resize(std::max(workers.size(), worker_count));
+    StepReduction reduction(*this, { workers.data(), worker_count }, &columns);
+    parallelFor(pool.get(), worker_count, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t worker = begin; worker < end; ++worker)
         {
-            forward(inputs[i]);
-            calculateGradient(targets[i]);
+            const size_t first = inputs.rows() * worker / worker_count;
+            const size_t count = inputs.rows() * (worker + 1) / worker_count - first;
+            Workspace& workspace = workers[worker];
+            prepareGradients(workspace);
+
+            // Only the active columns of the first layer are accumulated and
+            // reduced, the rest of that gradient may hold stale values
+            for (size_t layer = 2; layer < layers.size(); ++layer)
+            {
+                workspace.delta_weights[layer].fill(0.0);
+                std::fill(workspace.delta_biases[layer].begin(), workspace.delta_biases[layer].end(), 0.0);
+            }
+            std::fill(workspace.delta_biases[1].begin(), workspace.delta_biases[1].end(), 0.0);
+            for (size_t neuron = 0; neuron < layers[1].size; ++neuron)
+                for (uint32_t column : columns)
+                    workspace.delta_weights[1][neuron][column] = 0;
+
+            const SparseBatch rows = inputs.slice(first, count);
+            forwardBatch(rows, workspace);
+            workspace.layer_done = [&](size_t layer) { reduction.layerDone(layer); };
+            backwardBatch(rows, { targets[first], count, targets.cols }, workspace);
+            workspace.layer_done = nullptr;
         }
-        optimize(epoch + 1);
+    });
+
+    optimize(iteration, columns);
+}
+
+void NeuralNetwork::clearGradients(Workspace& worker) const
+{
+    for (size_t layer = 1; layer < worker.delta_weights.size(); ++layer)
+    {
+        worker.delta_weights[layer].fill(0.0);
+        std::fill(worker.delta_biases[layer].begin(), worker.delta_biases[layer].end(), 0.0);
     }
 }
 
-double NeuralNetwork::test(const std::vector<double> &inputs, const std::vector<double> &targets)
+void NeuralNetwork::swapGradients(Workspace& worker, size_t layer)
+{
+    prepareGradients(worker);
+    std::swap(layers[layer].delta_weights, worker.delta_weights[layer]);
+    std::swap(layers[layer].delta_biases, worker.delta_biases[layer]);
+}
+
+void NeuralNetwork::accumulateGradients(const BatchFiller& fill, size_t begin, size_t end, Workspace& worker, const std::function<void(size_t layer)>& layer_done) const
+{
+    NN_PROFILE_SCOPE("accumulate_gradients");
+    // A worker without samples is done with every layer right away
+    if (begin == end)
+        for (size_t layer = layers.size() - 1; layer >= 1; --layer)
+            layer_done(layer);
+    for (size_t first = begin; first < end; first += batch_size)
+    {
+        const size_t count = std::min(batch_size, end - first);
+        worker.input_batch.resize(count, getInputCount());
+        worker.target_batch.resize(count, getOutputCount());
+        {
+            NN_PROFILE_SCOPE("fill_batch", -1, 0, (double)count * (getInputCount() + getOutputCount()) * sizeof(Scalar));
+            fill(first, worker.input_batch.view(), worker.target_batch.view());
+        }
+        trainingForward(worker.input_batch.view(), worker);
+        // Only the last batch completes the gradients
+        worker.layer_done = first + count == end ? layer_done : nullptr;
+        trainingBackward(worker.target_batch.view(), worker);
+    }
+    worker.layer_done = nullptr;
+}
+
+void NeuralNetwork::reduceLayer(std::span<const Workspace> workers, size_t layer, size_t slice, size_t slice_count, const std::vector<uint32_t>* first_layer_columns)
+{
+    NN_PROFILE_SCOPE("reduce_gradients", layer);
+    // Each thread sums its own slice of the layer's gradients over all workers in order
+    const Kernels& kern = kernels();
+    auto reduce = [&](Scalar* target, size_t size, auto source)
+    {
+        const size_t begin = size * slice / slice_count;
+        const size_t end = size * (slice + 1) / slice_count;
+        for (const auto& worker : workers)
+            if (worker.delta_weights.size())
+                kern.axpy(1.0, source(worker) + begin, target + begin, end - begin);
+    };
+
+    Layer& l = layers[layer];
+    if (layer == 1 && first_layer_columns)
+    {
+        // Slices are whole neurons, summing a row's active columns over the workers
+        for (size_t neuron = l.size * slice / slice_count; neuron < l.size * (slice + 1) / slice_count; ++neuron)
+            for (const auto& worker : workers)
+                for (uint32_t column : *first_layer_columns)
+                    l.delta_weights[neuron][column] += worker.delta_weights[layer][neuron][column];
+    }
+    else
+    {
+        reduce(l.delta_weights.data(), l.delta_weights.size(),
+               [layer](const Workspace& worker) { return worker.delta_weights[layer].data(); });
+    }
+    reduce(l.delta_biases.data(), l.delta_biases.size(),
+           [layer](const Workspace& worker) { return worker.delta_biases[layer].data(); });
+}
+
+double NeuralNetwork::test(const std::vector<Scalar> &inputs, const std::vector<Scalar> &targets)
 {
     forward(inputs);
-    double cost = 0.0;
-    for (size_t i = 0; i < getOutputCount(); ++i)
-        cost += (targets[i] - getOutput()[i]) * (targets[i] - getOutput()[i]);
-    cost /= getOutputCount();
-    return cost;
+    return loss->evaluate(layers.back().neurons, getOutput(), targets);
 }
-double NeuralNetwork::test(const std::vector<std::vector<double>> &inputs, const std::vector<std::vector<double>> &targets)
+double NeuralNetwork::test(const std::vector<std::vector<Scalar>> &inputs, const std::vector<std::vector<Scalar>> &targets)
 {
     double cost = 0.0;
     for (size_t i = 0; i < inputs.size(); ++i)
@@ -72,18 +736,38 @@ double NeuralNetwork::test(const std::vector<std::vector<double>> &inputs, const
     return cost;
 }
 
+double NeuralNetwork::test(const IdxDataset& dataset)
+{
+    // Same cost as the per-sample test, computed a batch at a time
+    double cost = 0.0;
+    Matrix inputs;
+    Matrix targets;
+    for (size_t first = 0; first < dataset.size(); first += batch_size)
+    {
+        const size_t count = std::min(batch_size, dataset.size() - first);
+        inputs.resize(count, getInputCount());
+        targets.resize(count, getOutputCount());
+        dataset.fillBatch(first, inputs.view(), targets.view());
+        forwardBatch(inputs.view());
+        const LayerBatch& outputs = workspace.batches.back();
+        cost += loss->evaluateBatch(outputs.neurons.view(), outputs.activated_neurons.view(), targets.view());
+    }
+    return cost / dataset.size();
+}
+
 void NeuralNetwork::initWeights()
 {
     for (size_t layer = 1; layer < layers.size(); ++layer)
-        for (size_t neuron = 0; neuron < layers[layer].size; ++neuron)
-            for (size_t prev_neuron = 0; prev_neuron < layers[layer].input_size; ++prev_neuron)
-                layers[layer].weights[neuron][prev_neuron] = (Random::Float() * 2.0 - 1.0) * 0.1;
+        for (auto& weight : layers[layer].weights.values)
+            weight = (Random::Float() * 2.0 - 1.0) * 0.1;
 }
 
-static std::ostream &operator<<(std::ostream& os, const NeuralNetwork& net)
+std::ostream &operator<<(std::ostream& os, const NeuralNetwork& net)
 {
     uint32_t layer_count = net.getLayerCount();
     os.write((const char *)&layer_count, sizeof(layer_count));
+    Precision precision = SCALAR_PRECISION;
+    os.write((const char *)&precision, sizeof(precision));
 
     Optimizer::Type optimizer_type = net.optimizer->getType();
     os.write((const char *)&optimizer_type, sizeof(optimizer_type));
@@ -94,11 +778,13 @@ static std::ostream &operator<<(std::ostream& os, const NeuralNetwork& net)
 
     return os;
 }
-static std::istream &operator>>(std::istream& is, NeuralNetwork& net)
+std::istream &operator>>(std::istream& is, NeuralNetwork& net)
 {
     uint32_t layer_count = net.getLayerCount();
     is.read((char *)&layer_count, sizeof(layer_count));
     net.layers.resize(layer_count, Layer(net));
+    Precision precision;
+    is.read((char *)&precision, sizeof(precision));
 
     Optimizer::Type optimizer_type;
     is.read((char *)&optimizer_type, sizeof(optimizer_type));
@@ -108,8 +794,9 @@ static std::istream &operator>>(std::istream& is, NeuralNetwork& net)
     for (auto& layer : net.layers)
     {
         layer.net = &net;
-        is >> layer;
+        layer.load(is, precision);
     }
+    net.optimizer->build();
 
     return is;
 }
\ No newline at end of file
@@ -3,13 +3,51 @@
 #include <iostream>
 #include <vector>
 #include <concepts>
+#include <functional>
 #include "optimizers.h"
+#include "loss.h"
 #include "layer.h"
+#include "thread_pool.h"
+#include "dataset.h"
+#include "pipeline.h"
+#include "inference.h"
+#include "profiler.h"
+#include "reducer.h"
+#include "pruning.h"
+
+// Scratch of one thread running the batched passes. Data-parallel training
+// gives every worker its own workspace, gradients included, and reduces them
+// into the layers before optimizing.
+struct Workspace
+{
+    std::vector<LayerBatch> batches;
+    std::vector<Matrix> delta_weights;
+    std::vector<AlignedVector<Scalar>> delta_biases;
+    Matrix input_batch;
+    Matrix target_batch;
+    // Layers between checkpoints, reused by every segment
+    std::vector<LayerBatch> segment;
+    // Mixed-precision training keeps every layer in bfloat16, only the layer
+    // being computed is in Scalar
+    std::vector<HalfLayerBatch> half_batches;
+    LayerBatch scratch;
+    // Called by the backward passes with every layer whose gradients are
+    // complete, from the output down. Data-parallel training sets it for a
+    // worker's last batch of the step.
+    std::function<void(size_t layer)> layer_done;
+};
 
 class NeuralNetwork
 {
     friend class Layer;
+    friend class ModelFile;
+    friend class HogwildTrainer;
+    friend class Checkpointer;
+    friend class QuantizedNetwork;
 public:
+    // Fills the rows of inputs and targets with the samples starting at first
+    using BatchFiller = std::function<void(size_t first, MatrixView<Scalar> inputs, MatrixView<Scalar> targets)>;
+
     NeuralNetwork() = default;
 
     template <typename T = Relu, typename... Args>
@@ -18,18 +56,47 @@ public:
         layers.push_back(Layer(*this, layers.size(), layers.size() ? layers.back().size : 0, size, std::make_shared<T>(std::forward<Args>(args)...)));
     }
 
-    void forward(const std::vector<double> &inputs);
-    void backpropagate(const std::vector<double> &targets, size_t iteration = 1);
+    void forward(const std::vector<Scalar> &inputs);
+    void backpropagate(const std::vector<Scalar> &targets, size_t iteration = 1);
 
-    void calculateGradient(const std::vector<double> &targets);
+    void calculateGradient(const std::vector<Scalar> &targets);
+
+    // Batched passes, inputs and targets hold one sample per row
+    void forwardBatch(MatrixView<const Scalar> inputs);
+    void backwardBatch(MatrixView<const Scalar> targets);
+    // Reentrant versions, activations and gradients go to the workspace
+    void forwardBatch(MatrixView<const Scalar> inputs, Workspace& workspace) const;
+    // Reentrant single-sample forward, the outputs live in the workspace
+    std::span<const Scalar> predict(std::span<const Scalar> inputs, Workspace& workspace) const;
+    void backwardBatch(MatrixView<const Scalar> targets, Workspace& workspace) const;
+
+    // Sparse-input versions, the first hidden layer only reads and
+    // accumulates into the weight columns of nonzero inputs
+    void forwardBatch(const SparseBatch& inputs);
+    void backwardBatch(const SparseBatch& inputs, MatrixView<const Scalar> targets);
+    void forwardBatch(const SparseBatch& inputs, Workspace& workspace) const;
+    void backwardBatch(const SparseBatch& inputs, MatrixView<const Scalar> targets, Workspace& workspace) const;
 
     void optimize(size_t iteration = 1);
+    // Lazy step for gradients of a sparse batch, see Optimizer
+    void optimize(size_t iteration, std::span<const uint32_t> active_inputs);
 
-    void train(const std::vector<double> &inputs, const std::vector<double> &targets, size_t iteration = 1);
-    void train(std::vector<std::vector<double>> &inputs, std::vector<std::vector<double>> &targets, size_t epochs = 1);
+    void train(const std::vector<Scalar> &inputs, const std::vector<Scalar> &targets, size_t iteration = 1);
+    void train(std::vector<std::vector<Scalar>> &inputs, std::vector<std::vector<Scalar>> &targets, size_t epochs = 1);
+    // Full-batch training on samples converted into the batch buffers as they are used
+    void train(size_t sample_count, const BatchFiller& fill, size_t epochs = 1);
+    void train(const IdxDataset& dataset, size_t epochs = 1);
+    // Mini-batch training, one optimizer step per batch the pipeline hands out
+    void train(BatchPipeline& pipeline);
+    // One optimizer step on a mini-batch split across the thread pool
+    void trainBatch(MatrixView<const Scalar> inputs, MatrixView<const Scalar> targets, size_t iteration = 1);
+    // Same on sparse inputs, weights of inputs that are zero in the whole
+    // batch are skipped by every pass and the optimizer
+    void trainBatch(const SparseBatch& inputs, MatrixView<const Scalar> targets, size_t iteration = 1);
 
-    double test(const std::vector<double> &inputs, const std::vector<double> &targets);
-    double test(const std::vector<std::vector<double>> &inputs, const std::vector<std::vector<double>> &targets);
+    double test(const std::vector<Scalar> &inputs, const std::vector<Scalar> &targets);
+    double test(const std::vector<std::vector<Scalar>> &inputs, const std::vector<std::vector<Scalar>> &targets);
+    double test(const IdxDataset& dataset);
 
     void initWeights();
 
@@ -45,10 +112,114 @@ public:
     {
         return layers.size();
     }
-    const std::vector<double> &getOutput() const
+    const AlignedVector<Scalar> &getOutput() const
     {
         return layers.back().activated_neurons;
     }
+    const Matrix &getBatchOutput() const
+    {
+        return workspace.batches.back().activated_neurons;
+    }
+
+    void setBatchSize(size_t size)
+    {
+        batch_size = size;
+    }
+    size_t getBatchSize() const
+    {
+        return batch_size;
+    }
+
+    // Gradient checkpointing for the batched training passes. The forward
+    // pass only keeps the activations of these layers, the input and the
+    // output layer, the layers in between are recomputed one segment at a
+    // time during the backward pass. Empty keeps every layer.
+    void setCheckpoints(std::vector<size_t> layers);
+    const std::vector<size_t>& getCheckpoints() const
+    {
+        return checkpoints;
+    }
+    // Checkpoints recomputing the fewest FLOPs while a worker's activations
+    // for batches of batch_size fit in memory_budget bytes, throws
+    // std::invalid_argument if no choice fits
+    std::vector<size_t> planCheckpoints(size_t batch_size, size_t memory_budget) const;
+    // Activation bytes a worker keeps for batches of batch_size
+    size_t getActivationMemory(size_t batch_size, const std::vector<size_t>& checkpoints) const;
+
+    // Mixed-precision batched training. The activations the backward pass
+    // needs and the errors passed between layers are stored in bfloat16,
+    // which cuts their memory traffic 2x (NN_FLOAT) or 4x against Scalar.
+    // Weights, gradients and optimizer state stay in Scalar, and the loss is
+    // scaled by scaler, see LossScaler. Applies to trainBatch and full-batch
+    // training on dense inputs, checkpoints are not used while it is on.
+    void setMixedPrecision(bool enabled, const LossScaler& scaler = {})
+    {
+        mixed_precision = enabled;
+        loss_scaler = scaler;
+    }
+    bool isMixedPrecision() const
+    {
+        return mixed_precision;
+    }
+    const LossScaler& getLossScaler() const
+    {
+        return loss_scaler;
+    }
+
+    // Threads shared by data-parallel training, wide layers and the
+    // optimizers. Training results are deterministic for a fixed count.
+    // A non-empty cpus list pins the pool's workers to those cores.
+    void setThreadCount(size_t count, const std::vector<size_t>& cpus = {})
+    {
+        pool = count > 1 ? std::make_shared<ThreadPool>(count, cpus) : nullptr;
+    }
+    size_t getThreadCount() const
+    {
+        return pool ? pool->getThreadCount() : 1;
+    }
+    ThreadPool* getThreadPool() const
+    {
+        return pool.get();
+    }
+
+    // Multi-process data parallelism: every optimizer step first sums the
+    // gradients over all processes with the reducer, so their weights stay
+    // identical. Each step has to come from a single gradient pass. The
+    // reducer starts on a layer as soon as every worker thread's backward
+    // pass is done with it and its sum over the threads is complete, while
+    // the threads go on with the layers below.
+    // Sparse batches take full optimizer steps, since the active inputs
+    // differ between processes. Null trains on this process alone.
+    void setGradientReducer(std::shared_ptr<GradientReducer> gradient_reducer)
+    {
+        reducer = std::move(gradient_reducer);
+    }
+    GradientReducer* getGradientReducer() const
+    {
+        return reducer.get();
+    }
+
+    // Magnitude pruning during training. After every optimizer step the
+    // pruner prunes further as its schedule says and zeroes the pruned
+    // weights, see Pruner. Null trains all weights.
+    void setPruner(std::shared_ptr<Pruner> weight_pruner)
+    {
+        pruner = std::move(weight_pruner);
+    }
+    Pruner* getPruner() const
+    {
+        return pruner.get();
+    }
+
+    // Prediction-only copy of the trained network, see InferenceNetwork
+    InferenceNetwork freeze() const &
+    {
+        return InferenceNetwork(*this);
+    }
+    InferenceNetwork freeze() &&
+    {
+        return InferenceNetwork(std::move(*this));
+    }
 
     template <std::derived_from<Optimizer> T, typename... Args>
     void setOptimizer(Args&&... args)
@@ -56,17 +227,73 @@ public:
         optimizer = std::make_shared<T>(*this, std::forward<Args>(args)...);
     }
 
-    void operator()(const std::vector<double> &input)
+    // Loss minimized by training and reported by test, MeanSquaredError by default
+    template <std::derived_from<Loss> T, typename... Args>
+    void setLoss(Args&&... args)
+    {
+        loss = std::make_shared<T>(std::forward<Args>(args)...);
+    }
+    const Loss& getLoss() const
+    {
+        return *loss;
+    }
+
+    void operator()(const std::vector<Scalar> &input)
     {
         forward(input);
     }
 
-    static friend std::ostream &operator<<(std::ostream & os, const NeuralNetwork & net);
-    static friend std::istream &operator>>(std::istream & is, NeuralNetwork & net);
+    friend std::ostream &operator<<(std::ostream & os, const NeuralNetwork & net);
+    friend std::istream &operator>>(std::istream & is, NeuralNetwork & net);
 
 public:
     std::vector<Layer> layers;
 
+protected:
+    void calculateOutputErrors(MatrixView<const Scalar> targets, LayerBatch& output_batch) const;
+    // Adds the gradients of samples [begin, end) to the worker's, calling
+    // layer_done with every layer once they are complete
+    void accumulateGradients(const BatchFiller& fill, size_t begin, size_t end, Workspace& worker, const std::function<void(size_t layer)>& layer_done) const;
+    // Batched passes of training, checkpointed when checkpoints are set
+    void trainingForward(MatrixView<const Scalar> inputs, Workspace& worker) const;
+    void trainingBackward(MatrixView<const Scalar> targets, Workspace& worker) const;
+    void mixedForward(MatrixView<const Scalar> inputs, Workspace& worker) const;
+    void mixedBackward(MatrixView<const Scalar> targets, Workspace& worker) const;
+    // Divides the layers' gradients by the loss scale after mixed-precision
+    // passes. Returns false and clears them if any is not finite, the step
+    // is skipped then.
+    bool unscaleGradients();
+    // Sorted checkpoints with the input and output layer
+    std::vector<size_t> segmentBounds(const std::vector<size_t>& layers) const;
+    void prepareGradients(Workspace& worker) const;
+    void clearGradients(Workspace& worker) const;
+    // Exchanges a layer's gradients with the worker's, same shapes
+    void swapGradients(Workspace& worker, size_t layer);
+    // Sums a slice of one layer's gradients over the workers into the layer.
+    // With first_layer_columns only those columns of the first hidden
+    // layer's weight gradients are summed.
+    void reduceLayer(std::span<const Workspace> workers, size_t layer, size_t slice, size_t slice_count, const std::vector<uint32_t>* first_layer_columns = nullptr);
+    // Hands a layer whose gradients are complete to the gradient reducer
+    void gradientsReady(size_t layer)
+    {
+        if (reducer)
+            reducer->layerReady(*this, layer);
+    }
+
+    // Counts down the workers of a data-parallel step per layer
+    class StepReduction;
+
 protected:
     std::shared_ptr<Optimizer> optimizer = nullptr;
+    std::shared_ptr<Loss> loss = std::make_shared<MeanSquaredError>();
+    Workspace workspace;
+    // One workspace per thread for data-parallel training
+    std::vector<Workspace> workers;
+    size_t batch_size = 32;
+    std::vector<size_t> checkpoints;
+    bool mixed_precision = false;
+    LossScaler loss_scaler;
+    std::shared_ptr<ThreadPool> pool = nullptr;
+    std::shared_ptr<GradientReducer> reducer = nullptr;
+    std::shared_ptr<Pruner> pruner = nullptr;
 };
@@ -1,48 +1,105 @@
 #include "optimizers.h"
 #include "neural_network.h"
+#include "kernels.h"
 
-void Gd::operator()(size_t iteration)
+// Parameters updated per task when the network has a thread pool
+static constexpr size_t UPDATE_GRAIN = 1 << 14;
+
+template <typename F>
+static void updateChunks(const NeuralNetwork& net, size_t count, F&& update)
 {
+    parallelFor(net.getThreadPool(), count, UPDATE_GRAIN, [&](size_t begin, size_t end)
+    {
+        update(begin, end - begin);
+    });
+}
+
+// Calls update(offset, count) over the weights of l, only over the given
+// column runs of every neuron's row when there are any
+template <typename F>
+static void updateWeights(const NeuralNetwork& net, const Layer& l, const Optimizer::ColumnRuns* runs, F&& update)
+{
+    if (!runs)
+    {
+        updateChunks(net, l.weights.size(), update);
+        return;
+    }
+    size_t active = 0;
+    for (const auto& run : *runs)
+        active += run.second;
+    parallelFor(net.getThreadPool(), l.size, std::max<size_t>(1, UPDATE_GRAIN / std::max<size_t>(1, active)), [&](size_t begin, size_t end)
+    {
+        for (size_t neuron = begin; neuron < end; ++neuron)
+            for (const auto& [column, count] : *runs)
+                update(neuron * l.input_size + column, count);
+    });
+}
+
+Optimizer::ColumnRuns Optimizer::columnRuns(std::span<const uint32_t> columns)
+{
+    ColumnRuns runs;
+    for (uint32_t column : columns)
+    {
+        if (!runs.empty() && runs.back().first + runs.back().second == column)
+            ++runs.back().second;
+        else
+            runs.emplace_back(column, 1);
+    }
+    return runs;
+}
+
+void Optimizer::operator()(size_t iteration, std::span<const uint32_t> active_inputs)
+{
+    const ColumnRuns runs = columnRuns(active_inputs);
+    update(iteration, &runs);
+}
+
+void Gd::update(size_t iteration, const ColumnRuns* first_layer_runs)
+{
+    const Kernels& kern = kernels();
     for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
-        for (size_t next_neuron = 0; next_neuron < net.layers[layer].size; ++next_neuron)
-            for (size_t neuron = 0; neuron < net.layers[layer].input_size; ++neuron)
-                net.layers[layer].weights[next_neuron][neuron] += learning_rate * net.layers[layer].delta_weights[next_neuron][neuron];
-    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
-        for (size_t neuron = 0; neuron < net.layers[layer].size; ++neuron)
-            net.layers[layer].biases[neuron] += learning_rate * net.layers[layer].delta_biases[neuron];
+    {
+        auto& l = net.layers[layer];
+        NN_PROFILE_SCOPE("gd_update", layer, 2.0 * l.weights.size(), 4.0 * l.weights.size() * sizeof(Scalar));
+        updateWeights(net, l, layer == 1 ? first_layer_runs : nullptr, [&](size_t begin, size_t count)
+        {
+            kern.gd(l.weights.data() + begin, l.delta_weights.data() + begin, learning_rate, count);
+        });
+        kern.gd(l.biases.data(), l.delta_biases.data(), learning_rate, l.size);
+    }
 }
 
 Sgd::Sgd(NeuralNetwork& net, double learning_rate, double momentum)
     : momentum(momentum), Optimizer(net, Type::SGD, learning_rate)
 {
-    weight_velocities.resize(net.getLayerCount() - 1);
-    bias_velocities.resize(net.getLayerCount() - 1);
+    build();
+}
+
+void Sgd::build()
+{
+    const size_t layer_count = net.getLayerCount() ? net.getLayerCount() - 1 : 0;
+    weight_velocities.resize(layer_count);
+    bias_velocities.resize(layer_count);
     for (size_t layer = 0; layer < weight_velocities.size(); ++layer)
     {
-        weight_velocities[layer].resize(net.layers[layer + 1].size);
+        weight_velocities[layer].resize(net.layers[layer + 1].size, net.layers[layer].size);
         bias_velocities[layer].resize(net.layers[layer + 1].size);
-        for (size_t neuron = 0; neuron < weight_velocities[layer].size(); ++neuron)
-            weight_velocities[layer][neuron].resize(net.layers[layer].size);
     }
 }
 
-void Sgd::operator()(size_t iteration)
+void Sgd::update(size_t iteration, const ColumnRuns* first_layer_runs)
 {
+    const Kernels& kern = kernels();
     for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
-        for (size_t next_neuron = 0; next_neuron < net.layers[layer].size; ++next_neuron)
-            for (size_t neuron = 0; neuron < net.layers[layer].input_size; ++neuron)
-            {
-                auto& weight_vel = weight_velocities[layer - 1][next_neuron][neuron];
-                weight_vel = momentum * weight_vel + (1.0 - momentum) * net.layers[layer].delta_weights[next_neuron][neuron];
-                net.layers[layer].weights[next_neuron][neuron] += learning_rate * weight_vel;
-            }
-    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
-        for (size_t neuron = 0; neuron < net.layers[layer].size; ++neuron)
+    {
+        auto& l = net.layers[layer];
+        NN_PROFILE_SCOPE("sgd_update", layer, 4.0 * l.weights.size(), 6.0 * l.weights.size() * sizeof(Scalar));
+        updateWeights(net, l, layer == 1 ? first_layer_runs : nullptr, [&](size_t begin, size_t count)
         {
-            auto& bias_vel = bias_velocities[layer - 1][neuron];
-            bias_vel = momentum * bias_vel + (1.0 - momentum) * net.layers[layer].delta_biases[neuron];
-            net.layers[layer].biases[neuron] += learning_rate * bias_vel;
-        }
+            kern.sgd(l.weights.data() + begin, weight_velocities[layer - 1].data() + begin, l.delta_weights.data() + begin, learning_rate, momentum, count);
+        });
+        kern.sgd(l.biases.data(), bias_velocities[layer - 1].data(), l.delta_biases.data(), learning_rate, momentum, l.size);
+    }
 }
 
 void Sgd::reset()
@@ -50,29 +107,40 @@ void Sgd::reset()
     for (size_t layer = 0; layer < weight_velocities.size(); ++layer)
     {
         std::fill(bias_velocities[layer].begin(), bias_velocities[layer].end(), 0.0);
-        for (size_t neuron = 0; neuron < weight_velocities[layer].size(); ++neuron)
-            std::fill(weight_velocities[layer][neuron].begin(), weight_velocities[layer][neuron].end(), 0.0);
+        weight_velocities[layer].fill(0.0);
+    }
+}
+
+std::vector<std::span<Scalar>> Sgd::getState()
+{
+    std::vector<std::span<Scalar>> state;
+    for (size_t layer = 0; layer < weight_velocities.size(); ++layer)
+    {
+        state.emplace_back(weight_velocities[layer].data(), weight_velocities[layer].size());
+        state.emplace_back(bias_velocities[layer].data(), bias_velocities[layer].size());
     }
+    return state;
 }
 
 Adam::Adam(NeuralNetwork& net, double learning_rate, double beta1, double beta2)
     : beta1(beta1), beta2(beta2), Optimizer(net, Type::ADAM, learning_rate)
 {
-    weight_velocities.resize(net.getLayerCount() - 1);
-    square_weight_velocities.resize(weight_velocities.size());
-    bias_velocities.resize(net.getLayerCount() - 1);
+    build();
+}
+
+void Adam::build()
+{
+    const size_t layer_count = net.getLayerCount() ? net.getLayerCount() - 1 : 0;
+    weight_velocities.resize(layer_count);
+    square_weight_velocities.resize(layer_count);
+    bias_velocities.resize(layer_count);
     square_bias_velocities.resize(bias_velocities.size());
     for (size_t layer = 0; layer < weight_velocities.size(); ++layer)
     {
-        weight_velocities[layer].resize(net.layers[layer + 1].size);
-        square_weight_velocities[layer].resize(weight_velocities[layer].size());
+        weight_velocities[layer].resize(net.layers[layer + 1].size, net.layers[layer].size);
+        square_weight_velocities[layer].resize(net.layers[layer + 1].size, net.layers[layer].size);
         bias_velocities[layer].resize(net.layers[layer + 1].size);
         square_bias_velocities[layer].resize(bias_velocities[layer].size());
-        for (size_t neuron = 0; neuron < weight_velocities[layer].size(); ++neuron)
-        {
-            weight_velocities[layer][neuron].resize(net.layers[layer].size);
-            square_weight_velocities[layer][neuron].resize(weight_velocities[layer][neuron].size());
-        }
     }
 }
 
@@ -82,38 +150,47 @@ void Adam::reset()
     {
         std::fill(bias_velocities[layer].begin(), bias_velocities[layer].end(), 0.0);
         std::fill(square_bias_velocities[layer].begin(), square_bias_velocities[layer].end(), 0.0);
-        for (size_t neuron = 0; neuron < weight_velocities[layer].size(); ++neuron)
-        {
-            std::fill(weight_velocities[layer][neuron].begin(), weight_velocities[layer][neuron].end(), 0.0);
-            std::fill(square_weight_velocities[layer][neuron].begin(), square_weight_velocities[layer][neuron].end(), 0.0);
-        }
+        weight_velocities[layer].fill(0.0);
+        square_weight_velocities[layer].fill(0.0);
+    }
+}
+
+std::vector<std::span<Scalar>> Adam::getState()
+{
+    std::vector<std::span<Scalar>> state;
+    for (size_t layer = 0; layer < weight_velocities.size(); ++layer)
+    {
+        state.emplace_back(weight_velocities[layer].data(), weight_velocities[layer].size());
+        state.emplace_back(bias_velocities[layer].data(), bias_velocities[layer].size());
+        state.emplace_back(square_weight_velocities[layer].data(), square_weight_velocities[layer].size());
+        state.emplace_back(square_bias_velocities[layer].data(), square_bias_velocities[layer].size());
     }
+    return state;
 }
 
-void Adam::operator()(size_t iteration)
+void Adam::update(size_t iteration, const ColumnRuns* first_layer_runs)
 {
+    // m / bi1 / (sqrt(v / bi2) + epsilon) rewritten as
+    // (sqrt(bi2) / bi1) * m / (sqrt(v) + epsilon * sqrt(bi2)), so the
+    // per-weight loop needs no bias correction of its own
     double epsilon = 1e-7;
 
     double bi1 = 1.0 - pow(beta1, iteration);
     double bi2 = 1.0 - pow(beta2, iteration);
+    double step_size = learning_rate * std::sqrt(bi2) / bi1;
+    double corrected_epsilon = epsilon * std::sqrt(bi2);
 
+    const Kernels& kern = kernels();
     for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
-        for (size_t next_neuron = 0; next_neuron < net.layers[layer].size; ++next_neuron)
-            for (size_t neuron = 0; neuron < net.layers[layer].input_size; ++neuron)
-            {
-                auto& vel = weight_velocities[layer - 1][next_neuron][neuron];
-                auto& sq_vel = square_weight_velocities[layer - 1][next_neuron][neuron];
-                vel = beta1 * vel + (1.0 - beta1) * net.layers[layer].delta_weights[next_neuron][neuron];
-                sq_vel = beta2 * sq_vel + (1.0 - beta2) * net.layers[layer].delta_weights[next_neuron][neuron] * net.layers[layer].delta_weights[next_neuron][neuron];
-                net.layers[layer].weights[next_neuron][neuron] += learning_rate * (vel / bi1) / (sqrt(sq_vel / bi2) + epsilon);
-            }
-    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
-        for (size_t neuron = 0; neuron < net.layers[layer].size; ++neuron)
+    {
+        auto& l = net.layers[layer];
+        NN_PROFILE_SCOPE("adam_update", layer, 10.0 * l.weights.size(), 8.0 * l.weights.size() * sizeof(Scalar));
+        updateWeights(net, l, layer == 1 ? first_layer_runs : nullptr, [&](size_t begin, size_t count)
         {
-            auto& vel = bias_velocities[layer - 1][neuron];
-            auto& sq_vel = square_bias_velocities[layer - 1][neuron];
-            vel = beta1 * vel + (1.0 - beta1) * net.layers[layer].delta_biases[neuron];
-            sq_vel = beta2 * sq_vel + (1.0 - beta2) * net.layers[layer].delta_biases[neuron] * net.layers[layer].delta_biases[neuron];
-            net.layers[layer].biases[neuron] += learning_rate * (vel / bi1) / (sqrt(sq_vel / bi2) + epsilon);
-        }
+            kern.adam(l.weights.data() + begin, weight_velocities[layer - 1].data() + begin, square_weight_velocities[layer - 1].data() + begin,
+                      l.delta_weights.data() + begin, step_size, beta1, beta2, corrected_epsilon, count);
+        });
+        kern.adam(l.biases.data(), bias_velocities[layer - 1].data(), square_bias_velocities[layer - 1].data(), l.delta_biases.data(),
+                  step_size, beta1, beta2, corrected_epsilon, l.size);
+    }
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <vector>
+#include <span>
 #include <iostream>
+#include "matrix.h"
 
 class NeuralNetwork;
 class Layer;
@@ -21,14 +23,41 @@ public:
     {
     }
 
-    virtual void operator()(size_t iteration = 0) = 0;
+    // Runs of consecutive columns as (first column, count)
+    using ColumnRuns = std::vector<std::pair<size_t, size_t>>;
+
+    void operator()(size_t iteration = 0)
+    {
+        update(iteration, nullptr);
+    }
+    // Lazy step after a sparse batch. The first hidden layer's weights are
+    // only updated in the sorted active_inputs columns, so the weights and
+    // state of inputs that were zero in the whole batch are not touched.
+    // Exact for Gd, Sgd and Adam skip the momentum decay of those weights.
+    void operator()(size_t iteration, std::span<const uint32_t> active_inputs);
 
     virtual void reset() {}
+    // Sizes per-parameter state to the network's layers, called again
+    // once a loaded network knows its layers
+    virtual void build() {}
+    // Per-parameter state such as velocities, in a fixed order, for
+    // checkpoints that resume training exactly
+    virtual std::vector<std::span<Scalar>> getState()
+    {
+        return {};
+    }
 
     Type getType() const
     {
         return type;
     }
+    double getLearningRate() const
+    {
+        return learning_rate;
+    }
+
+    // Sorted columns grouped into runs of consecutive ones
+    static ColumnRuns columnRuns(std::span<const uint32_t> columns);
 
     void save(std::ostream &os) const
     {
@@ -53,6 +82,9 @@ public:
     }
 
 protected:
+    // first_layer_runs limits the first hidden layer's weight updates, null for all
+    virtual void update(size_t iteration, const ColumnRuns* first_layer_runs) = 0;
+
     virtual void saveData(std::ostream &os) const {}
     virtual void loadData(std::istream &is) {}
 
@@ -68,16 +100,18 @@ struct Gd: public Optimizer
         : Optimizer(net, Type::GD, learning_rate)
     {}
 
-    void operator()(size_t iteration = 0) override;
+    void update(size_t iteration, const ColumnRuns* first_layer_runs) override;
 };
 
 struct Sgd: public Optimizer
 {
     Sgd(NeuralNetwork& net, double learning_rate = 0.001, double momentum = 0.9);
 
-    void operator()(size_t iteration = 0) override;
+    void update(size_t iteration, const ColumnRuns* first_layer_runs) override;
 
     void reset() override;
+    void build() override;
+    std::vector<std::span<Scalar>> getState() override;
 
     void saveData(std::ostream &os) const override
     {
@@ -88,8 +122,8 @@ struct Sgd: public Optimizer
         is.read((char *)&momentum, sizeof(momentum));
     }
 
-    std::vector<std::vector<std::vector<double>>> weight_velocities;
-    std::vector<std::vector<double>> bias_velocities;
+    std::vector<Matrix> weight_velocities;
+    std::vector<AlignedVector<Scalar>> bias_velocities;
     double momentum;
 };
 
@@ -97,9 +131,11 @@ struct Adam: public Optimizer
 {
     Adam(NeuralNetwork& net, double learning_rate = 0.001, double beta1 = 0.9, double beta2 = 0.999);
 
-    void operator()(size_t iteration = 0) override;
+    void update(size_t iteration, const ColumnRuns* first_layer_runs) override;
 
     void reset() override;
+    void build() override;
+    std::vector<std::span<Scalar>> getState() override;
 
     void saveData(std::ostream &os) const override
     {
@@ -114,10 +150,10 @@ struct Adam: public Optimizer
         is.read((char *)&beta2, sizeof(beta2));
     }
 
-    std::vector<std::vector<std::vector<double>>> weight_velocities;
-    std::vector<std::vector<double>> bias_velocities;
-    std::vector<std::vector<std::vector<double>>> square_weight_velocities;
-    std::vector<std::vector<double>> square_bias_velocities;
+    std::vector<Matrix> weight_velocities;
+    std::vector<AlignedVector<Scalar>> bias_velocities;
+    std::vector<Matrix> square_weight_velocities;
+    std::vector<AlignedVector<Scalar>> square_bias_velocities;
     double beta1;
     double beta2;
 };
@@ -0,0 +1,142 @@
+#include "pipeline.h"
+#include <numeric>
+
+BatchPipeline::BatchPipeline(size_t sample_count, size_t input_size, size_t target_size, SampleFiller fill,
+                             size_t batch_size, size_t epochs, uint64_t seed, bool shuffle, size_t depth)
+    : sample_count(sample_count), input_size(input_size), target_size(target_size), fill(std::move(fill)),
+      batch_size(std::max<size_t>(batch_size, 1)), epochs(epochs), seed(seed), shuffle(shuffle),
+      order(sample_count), slots(std::max<size_t>(depth, 1))
+{
+    for (auto& slot : slots)
+    {
+        slot.inputs.resize(this->batch_size, input_size);
+        slot.targets.resize(this->batch_size, target_size);
+    }
+    producer = std::thread(&BatchPipeline::produce, this);
+}
+
+BatchPipeline::BatchPipeline(const IdxDataset& dataset, size_t batch_size, size_t epochs, uint64_t seed, bool shuffle, size_t depth)
+    : BatchPipeline(dataset.size(), dataset.getInputSize(), dataset.getClassCount(),
+                    [&dataset](std::span<const size_t> samples, MatrixView<Scalar> inputs, MatrixView<Scalar> targets)
+                    {
+                        dataset.fillBatch(samples, inputs, targets);
+                    },
+                    batch_size, epochs, seed, shuffle, depth)
+{
+}
+
+BatchPipeline::~BatchPipeline()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    freed.notify_all();
+    producer.join();
+}
+
+const BatchPipeline::Batch* BatchPipeline::next()
+{
+    std::unique_lock lock(mutex);
+    // The batch returned last time goes back to the producer
+    if (released < consumed)
+    {
+        ++released;
+        freed.notify_one();
+    }
+
+    if (consumed == produced && !finished)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        ready.wait(lock, [this] { return consumed < produced || finished; });
+        ++stats.trainer_waits;
+        stats.trainer_wait_time += std::chrono::steady_clock::now() - start;
+    }
+
+    if (consumed < produced)
+    {
+        ++stats.batches;
+        return &slots[consumed++ % slots.size()];
+    }
+    if (error)
+        std::rethrow_exception(error);
+    return nullptr;
+}
+
+BatchPipeline::Stats BatchPipeline::getStats() const
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void BatchPipeline::produce()
+{
+    std::iota(order.begin(), order.end(), size_t(0));
+    uint64_t state = seed;
+    bool stopped = false;
+    try
+    {
+        for (size_t epoch = 0; epoch < epochs && !stopped; ++epoch)
+        {
+            if (shuffle)
+                shuffleSamples(state);
+
+            for (size_t first = 0; first < sample_count; first += batch_size)
+            {
+                size_t slot_index;
+                {
+                    std::unique_lock lock(mutex);
+                    if (produced - released == slots.size())
+                    {
+                        ++stats.pipeline_waits;
+                        freed.wait(lock, [this] { return produced - released < slots.size() || stopping; });
+                    }
+                    stopped = stopping;
+                    slot_index = produced % slots.size();
+                }
+                if (stopped)
+                    break;
+
+                // The slot is owned by this thread until produced is advanced
+                const size_t count = std::min(batch_size, sample_count - first);
+                Batch& batch = slots[slot_index];
+                batch.inputs.resize(count, input_size);
+                batch.targets.resize(count, target_size);
+                batch.epoch = epoch;
+                fill(std::span<const size_t>(order.data() + first, count), batch.inputs.view(), batch.targets.view());
+
+                {
+                    std::lock_guard lock(mutex);
+                    ++produced;
+                }
+                ready.notify_one();
+            }
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard lock(mutex);
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        finished = true;
+    }
+    ready.notify_one();
+}
+
+void BatchPipeline::shuffleSamples(uint64_t& state)
+{
+    // Fisher-Yates with a private splitmix64 stream, the shared Random
+    // generator is not safe to use from this thread
+    auto next = [&state]
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    };
+    for (size_t i = order.size(); i > 1; --i)
+        std::swap(order[i - 1], order[next() % i]);
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include "matrix.h"
+#include "dataset.h"
+
+// Assembles shuffled mini-batches on a background thread while the trainer
+// works on the previous ones. Batches are handed out from a ring of depth
+// buffers, so data preparation and compute overlap.
+class BatchPipeline
+{
+public:
+    // Writes the given samples into the rows of inputs and targets
+    using SampleFiller = std::function<void(std::span<const size_t> samples, MatrixView<Scalar> inputs, MatrixView<Scalar> targets)>;
+
+    struct Batch
+    {
+        Matrix inputs;
+        Matrix targets;
+        size_t epoch = 0;
+    };
+
+    struct Stats
+    {
+        size_t batches = 0;
+        // Batches the trainer had to wait for, and the total time it waited
+        size_t trainer_waits = 0;
+        std::chrono::nanoseconds trainer_wait_time{};
+        // Times the pipeline was ahead and waited for a free buffer
+        size_t pipeline_waits = 0;
+    };
+
+    // Samples are reshuffled every epoch from seed, the same seed gives the
+    // same batches. The last batch of an epoch may be smaller than batch_size.
+    BatchPipeline(size_t sample_count, size_t input_size, size_t target_size, SampleFiller fill,
+                  size_t batch_size, size_t epochs, uint64_t seed, bool shuffle = true, size_t depth = 2);
+    BatchPipeline(const IdxDataset& dataset, size_t batch_size, size_t epochs, uint64_t seed, bool shuffle = true, size_t depth = 2);
+    ~BatchPipeline();
+
+    BatchPipeline(const BatchPipeline&) = delete;
+    BatchPipeline& operator=(const BatchPipeline&) = delete;
+
+    // Blocks until the next batch is ready and returns nullptr after the
+    // last epoch. The batch stays valid until the following call. Errors
+    // thrown while filling are rethrown here.
+    const Batch* next();
+
+    Stats getStats() const;
+
+private:
+    void produce();
+    void shuffleSamples(uint64_t& state);
+
+private:
+    const size_t sample_count;
+    const size_t input_size;
+    const size_t target_size;
+    const SampleFiller fill;
+    const size_t batch_size;
+    const size_t epochs;
+    const uint64_t seed;
+    const bool shuffle;
+
+    std::vector<size_t> order;
+    std::vector<Batch> slots;
+    // Batches filled, handed to the trainer and given back by it
+    size_t produced = 0;
+    size_t consumed = 0;
+    size_t released = 0;
+    bool finished = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    Stats stats;
+
+    mutable std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable freed;
+    std::thread producer;
+};
\ No newline at end of file
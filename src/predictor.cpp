@@ -0,0 +1,81 @@
+#include "predictor.h"
+
+BatchingPredictor::BatchingPredictor(const InferenceNetwork& net, size_t max_batch_size, std::chrono::microseconds deadline)
+    : net(net), max_batch_size(std::max<size_t>(max_batch_size, 1)), deadline(deadline)
+{
+    server = std::thread(&BatchingPredictor::serve, this);
+}
+
+BatchingPredictor::~BatchingPredictor()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    arrived.notify_one();
+    server.join();
+}
+
+void BatchingPredictor::predict(std::span<const Scalar> inputs, std::span<Scalar> outputs)
+{
+    // The request lives on this thread's stack until the server marks it done
+    Request request{ inputs, outputs, std::chrono::steady_clock::now() };
+    std::unique_lock lock(mutex);
+    queue.push_back(&request);
+    ++stats.requests;
+    if (queue.size() == 1 || queue.size() == max_batch_size)
+        arrived.notify_one();
+    completed.wait(lock, [&request] { return request.done; });
+}
+
+std::vector<Scalar> BatchingPredictor::predict(std::span<const Scalar> inputs)
+{
+    std::vector<Scalar> outputs(net.getOutputCount());
+    predict(inputs, outputs);
+    return outputs;
+}
+
+BatchingPredictor::Stats BatchingPredictor::getStats() const
+{
+    std::lock_guard lock(mutex);
+    return stats;
+}
+
+void BatchingPredictor::serve()
+{
+    InferenceScratch scratch;
+    Matrix inputs(max_batch_size, net.getInputCount());
+    std::vector<Request*> batch;
+    batch.reserve(max_batch_size);
+
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        arrived.wait(lock, [this] { return !queue.empty() || stopping; });
+        if (queue.empty())
+            return;
+
+        // Give more requests until the oldest one's deadline to join the batch
+        const auto start_by = queue.front()->arrival + deadline;
+        arrived.wait_until(lock, start_by, [this] { return queue.size() >= max_batch_size || stopping; });
+
+        const size_t count = std::min(queue.size(), max_batch_size);
+        batch.assign(queue.begin(), queue.begin() + count);
+        queue.erase(queue.begin(), queue.begin() + count);
+        ++stats.batches;
+        stats.full_batches += count == max_batch_size;
+        lock.unlock();
+
+        inputs.resize(count, net.getInputCount());
+        for (size_t row = 0; row < count; ++row)
+            std::copy(batch[row]->inputs.begin(), batch[row]->inputs.end(), inputs[row]);
+        MatrixView<const Scalar> outputs = net.predictBatch(inputs.view(), scratch);
+        for (size_t row = 0; row < count; ++row)
+            std::copy(outputs[row], outputs[row] + outputs.cols, batch[row]->outputs.begin());
+
+        lock.lock();
+        for (Request* request : batch)
+            request->done = true;
+        completed.notify_all();
+    }
+}
\ No newline at end of file
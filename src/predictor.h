@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <span>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "inference.h"
+
+// Serves single-sample predictions from many threads by coalescing them into
+// micro-batches. A batch is run once it is full or once its oldest request
+// has waited for the deadline, whichever comes first.
+class BatchingPredictor
+{
+public:
+    struct Stats
+    {
+        size_t requests = 0;
+        size_t batches = 0;
+        // Batches started because they were full rather than by the deadline
+        size_t full_batches = 0;
+    };
+
+    // The network must outlive the predictor
+    BatchingPredictor(const InferenceNetwork& net, size_t max_batch_size = 32,
+                      std::chrono::microseconds deadline = std::chrono::microseconds(200));
+    ~BatchingPredictor();
+
+    BatchingPredictor(const BatchingPredictor&) = delete;
+    BatchingPredictor& operator=(const BatchingPredictor&) = delete;
+
+    // Blocks until the outputs of this sample were written, safe to call
+    // from any number of threads
+    void predict(std::span<const Scalar> inputs, std::span<Scalar> outputs);
+    std::vector<Scalar> predict(std::span<const Scalar> inputs);
+
+    Stats getStats() const;
+
+private:
+    struct Request
+    {
+        std::span<const Scalar> inputs;
+        std::span<Scalar> outputs;
+        std::chrono::steady_clock::time_point arrival;
+        bool done = false;
+    };
+
+    void serve();
+
+private:
+    const InferenceNetwork& net;
+    const size_t max_batch_size;
+    const std::chrono::microseconds deadline;
+
+    std::deque<Request*> queue;
+    bool stopping = false;
+    Stats stats;
+    mutable std::mutex mutex;
+    std::condition_variable arrived;
+    std::condition_variable completed;
+    std::thread server;
+};
\ No newline at end of file
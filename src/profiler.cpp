@@ -0,0 +1,126 @@
+#include "profiler.h"
+#include <map>
+#include <string>
+#include <tuple>
+#include <algorithm>
+#include <iomanip>
+
+Profiler::Profiler()
+    : start(std::chrono::steady_clock::now())
+{
+}
+
+Profiler& Profiler::get()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::ThreadEvents& Profiler::threadEvents()
+{
+    thread_local std::shared_ptr<ThreadEvents> events = [this]
+    {
+        auto events = std::make_shared<ThreadEvents>();
+        std::lock_guard lock(mutex);
+        events->thread = (uint32_t)threads.size();
+        threads.push_back(events);
+        return events;
+    }();
+    return *events;
+}
+
+void Profiler::record(const ProfileEvent& event)
+{
+    ThreadEvents& events = threadEvents();
+    // Only contended while another thread reads the events
+    std::lock_guard lock(events.mutex);
+    events.events.push_back(event);
+    events.events.back().thread = events.thread;
+}
+
+void Profiler::clear()
+{
+    std::lock_guard lock(mutex);
+    for (const auto& events : threads)
+    {
+        std::lock_guard events_lock(events->mutex);
+        events->events.clear();
+    }
+}
+
+std::vector<ProfileEvent> Profiler::getEvents() const
+{
+    std::vector<ProfileEvent> result;
+    std::lock_guard lock(mutex);
+    for (const auto& events : threads)
+    {
+        std::lock_guard events_lock(events->mutex);
+        result.insert(result.end(), events->events.begin(), events->events.end());
+    }
+    std::sort(result.begin(), result.end(), [](const ProfileEvent& a, const ProfileEvent& b) { return a.start_ns < b.start_ns; });
+    return result;
+}
+
+void Profiler::writeTrace(std::ostream& os) const
+{
+    const auto events = getEvents();
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        const ProfileEvent& event = events[i];
+        // Complete events, timestamps are in microseconds
+        os << (i ? ",\n" : "\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"nn\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+           << ",\"ts\":" << event.start_ns * 1e-3 << ",\"dur\":" << event.duration_ns * 1e-3
+           << ",\"args\":{\"layer\":" << event.layer << ",\"flops\":" << event.flops << ",\"bytes\":" << event.bytes << "}}";
+    }
+    os << "\n]}\n";
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void Profiler::writeSummary(std::ostream& os) const
+{
+    struct Total
+    {
+        size_t calls = 0;
+        uint64_t ns = 0;
+        double flops = 0;
+        double bytes = 0;
+    };
+    std::map<std::tuple<std::string, int64_t>, Total> totals;
+    for (const auto& event : getEvents())
+    {
+        Total& total = totals[{ event.name, event.layer }];
+        ++total.calls;
+        total.ns += event.duration_ns;
+        total.flops += event.flops;
+        total.bytes += event.bytes;
+    }
+
+    std::vector<std::pair<std::tuple<std::string, int64_t>, Total>> rows(totals.begin(), totals.end());
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.second.ns > b.second.ns; });
+
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::left << std::setw(24) << "phase" << std::right << std::setw(6) << "layer" << std::setw(10) << "calls"
+       << std::setw(12) << "total ms" << std::setw(12) << "mean us" << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s" << '\n';
+    os << std::fixed;
+    for (const auto& [key, total] : rows)
+    {
+        const auto& [name, layer] = key;
+        const double seconds = total.ns * 1e-9;
+        os << std::left << std::setw(24) << name << std::right << std::setw(6);
+        if (layer >= 0)
+            os << layer;
+        else
+            os << "-";
+        os << std::setw(10) << total.calls << std::setprecision(3) << std::setw(12) << total.ns * 1e-6
+           << std::setw(12) << total.ns * 1e-3 / total.calls << std::setprecision(2)
+           << std::setw(10) << (seconds > 0 ? total.flops * 1e-9 / seconds : 0.0)
+           << std::setw(10) << (seconds > 0 ? total.bytes * 1e-9 / seconds : 0.0) << '\n';
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
\ No newline at end of file
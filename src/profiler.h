@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+
+// Opt-in instrumentation of the training hot paths, configure with
+// -DNN_PROFILE=ON. Without it NN_PROFILE_SCOPE expands to nothing, so its
+// arguments are not even evaluated.
+//
+//   NN_PROFILE_SCOPE("forward", index, 2.0 * size * input_size, weight_bytes);
+//
+// records the time until the end of the enclosing block together with the
+// floating point operations and bytes the block is expected to do.
+struct ProfileEvent
+{
+    const char* name;
+    // Layer index, -1 for phases of the whole network
+    int64_t layer;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    double flops;
+    double bytes;
+    uint32_t thread;
+};
+
+class Profiler
+{
+public:
+#ifdef NN_PROFILE
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    static Profiler& get();
+
+    // Nanoseconds since the profiler was created
+    uint64_t now() const
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Appends to the calling thread's own buffer
+    void record(const ProfileEvent& event);
+
+    // Reading and clearing expect no thread to be recording at the same time
+    void clear();
+    std::vector<ProfileEvent> getEvents() const;
+
+    // Chrome trace_event JSON, load it in chrome://tracing or Perfetto
+    void writeTrace(std::ostream& os) const;
+    // Calls, time, GFLOP/s and GB/s per phase and layer, slowest first
+    void writeSummary(std::ostream& os) const;
+
+private:
+    struct ThreadEvents
+    {
+        std::mutex mutex;
+        std::vector<ProfileEvent> events;
+        uint32_t thread;
+    };
+
+    Profiler();
+    ThreadEvents& threadEvents();
+
+private:
+    const std::chrono::steady_clock::time_point start;
+    mutable std::mutex mutex;
+    // Kept alive after their threads exit so their events can still be read
+    std::vector<std::shared_ptr<ThreadEvents>> threads;
+};
+
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name, int64_t layer = -1, double flops = 0, double bytes = 0)
+        : event{ name, layer, Profiler::get().now(), 0, flops, bytes, 0 }
+    {
+    }
+    ~ProfileScope()
+    {
+        event.duration_ns = Profiler::get().now() - event.start_ns;
+        Profiler::get().record(event);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ProfileEvent event;
+};
+
+#define NN_PROFILE_CONCAT_(a, b) a##b
+#define NN_PROFILE_CONCAT(a, b) NN_PROFILE_CONCAT_(a, b)
+#ifdef NN_PROFILE
+#define NN_PROFILE_SCOPE(...) ProfileScope NN_PROFILE_CONCAT(profile_scope_, __LINE__)(__VA_ARGS__)
+#else
+#define NN_PROFILE_SCOPE(...)
+#endif
\ No newline at end of file
@@ -0,0 +1,127 @@
+#include "pruning.h"
+#include "neural_network.h"
+#include <algorithm>
+#include <cmath>
+
+static constexpr size_t BLOCK_ROWS = BlockSparseMatrix::BLOCK_ROWS;
+
+static size_t blockRows(const Layer& layer)
+{
+    return (layer.size + BLOCK_ROWS - 1) / BLOCK_ROWS;
+}
+
+double PruningSchedule::sparsityAt(size_t iteration) const
+{
+    if (iteration < begin_step)
+        return 0;
+    if (iteration >= end_step)
+        return final_sparsity;
+    const double remaining = 1 - double(iteration - begin_step) / double(end_step - begin_step);
+    return final_sparsity + (initial_sparsity - final_sparsity) * remaining * remaining * remaining;
+}
+
+void Pruner::buildMasks(const NeuralNetwork& net)
+{
+    bool built = masks.size() == net.getLayerCount();
+    for (size_t layer = 1; built && layer < net.getLayerCount(); ++layer)
+        built = masks[layer].size() == blockRows(net.layers[layer]) * net.layers[layer].input_size;
+    if (built)
+        return;
+
+    masks.assign(net.getLayerCount(), {});
+    sparsity = 1;
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+    {
+        const Layer& l = net.layers[layer];
+        std::vector<uint8_t>& mask = masks[layer];
+        mask.assign(blockRows(l) * l.input_size, 0);
+        for (size_t neuron = 0; neuron < l.size; ++neuron)
+        {
+            uint8_t* block_mask = mask.data() + neuron / BLOCK_ROWS * l.input_size;
+            const Scalar* weights = l.weights[neuron];
+            for (size_t input = 0; input < l.input_size; ++input)
+                block_mask[input] |= weights[input] != 0;
+        }
+        const size_t pruned = std::count(mask.begin(), mask.end(), 0);
+        sparsity = std::min(sparsity, mask.empty() ? 0 : double(pruned) / double(mask.size()));
+    }
+    if (masks.size() <= 1)
+        sparsity = 0;
+}
+
+void Pruner::prune(NeuralNetwork& net, double target)
+{
+    buildMasks(net);
+    std::vector<Scalar> scores;
+    std::vector<size_t> candidates;
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+    {
+        const Layer& l = net.layers[layer];
+        std::vector<uint8_t>& mask = masks[layer];
+        const size_t pruned = std::count(mask.begin(), mask.end(), 0);
+        const size_t wanted = (size_t)std::llround(target * double(mask.size()));
+        if (wanted <= pruned)
+            continue;
+
+        // Mean squared weight of every block, the last block row may be shorter
+        scores.assign(mask.size(), 0);
+        for (size_t neuron = 0; neuron < l.size; ++neuron)
+        {
+            const size_t block_row = neuron / BLOCK_ROWS;
+            const Scalar rows = (Scalar)std::min(BLOCK_ROWS, l.size - block_row * BLOCK_ROWS);
+            Scalar* block_scores = scores.data() + block_row * l.input_size;
+            const Scalar* weights = l.weights[neuron];
+            for (size_t input = 0; input < l.input_size; ++input)
+                block_scores[input] += weights[input] * weights[input] / rows;
+        }
+
+        candidates.clear();
+        for (size_t block = 0; block < mask.size(); ++block)
+            if (mask[block])
+                candidates.push_back(block);
+        const size_t count = wanted - pruned;
+        std::nth_element(candidates.begin(), candidates.begin() + count, candidates.end(), [&](size_t a, size_t b)
+        {
+            return scores[a] < scores[b] || (scores[a] == scores[b] && a < b);
+        });
+        for (size_t i = 0; i < count; ++i)
+            mask[candidates[i]] = 0;
+    }
+    sparsity = std::max(sparsity, target);
+    applyMasks(net);
+}
+
+void Pruner::update(NeuralNetwork& net, size_t iteration, const Optimizer::ColumnRuns* first_layer_runs)
+{
+    buildMasks(net);
+    const double target = schedule.sparsityAt(iteration);
+    const bool scheduled = iteration >= schedule.end_step || schedule.frequency == 0 ||
+                           (iteration >= schedule.begin_step && (iteration - schedule.begin_step) % schedule.frequency == 0);
+    if (scheduled && target > sparsity)
+        prune(net, target);
+    else
+        applyMasks(net, first_layer_runs);
+}
+
+void Pruner::applyMasks(NeuralNetwork& net, const Optimizer::ColumnRuns* first_layer_runs) const
+{
+    for (size_t layer = 1; layer < std::min(masks.size(), net.getLayerCount()); ++layer)
+    {
+        Layer& l = net.layers[layer];
+        for (size_t neuron = 0; neuron < l.size; ++neuron)
+        {
+            const uint8_t* block_mask = masks[layer].data() + neuron / BLOCK_ROWS * l.input_size;
+            Scalar* weights = l.weights[neuron];
+            auto zero = [&](size_t first, size_t count)
+            {
+                for (size_t input = first; input < first + count; ++input)
+                    weights[input] = block_mask[input] ? weights[input] : 0;
+            };
+            if (layer == 1 && first_layer_runs)
+                for (const auto& [column, count] : *first_layer_runs)
+                    zero(column, count);
+            else
+                zero(0, l.input_size);
+        }
+    }
+}
\ No newline at end of file
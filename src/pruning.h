@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "optimizers.h"
+#include "sparse.h"
+
+class NeuralNetwork;
+
+// Gradual pruning after Zhu & Gupta (2017). The sparsity rises from
+// initial_sparsity at begin_step to final_sparsity at end_step along
+// s(t) = final + (initial - final) * (1 - (t - begin) / (end - begin))^3,
+// pruning every frequency steps, fast at first while there are many
+// redundant weights and slowly towards the end.
+struct PruningSchedule
+{
+    // Target sparsity after the optimizer step of the given iteration
+    double sparsityAt(size_t iteration) const;
+
+    double initial_sparsity = 0;
+    double final_sparsity = 0;
+    size_t begin_step = 0;
+    size_t end_step = 0;
+    size_t frequency = 100;
+};
+
+// Magnitude pruning in blocks of BlockSparseMatrix::BLOCK_ROWS neurons by
+// one input, the blocks the block-sparse inference kernels skip. Every
+// layer loses the same share of its blocks, those with the smallest mean
+// squared weight. Pruned weights are set back to zero after every optimizer
+// step, whatever the optimizer keeps in its state, so they stay zero with
+// Gd, Sgd and Adam alike. See NeuralNetwork::setPruner.
+class Pruner
+{
+public:
+    explicit Pruner(const PruningSchedule& schedule = {})
+        : schedule(schedule)
+    {}
+
+    // Prunes every layer to at least sparsity, blocks pruned before stay pruned
+    void prune(NeuralNetwork& net, double sparsity);
+    // Called after the optimizer step of iteration, prunes further when the
+    // schedule says so and zeroes the pruned weights. With first_layer_runs
+    // only those columns of the first hidden layer are zeroed, the others
+    // were not updated.
+    void update(NeuralNetwork& net, size_t iteration, const Optimizer::ColumnRuns* first_layer_runs = nullptr);
+    // Zeroes the pruned weights
+    void applyMasks(NeuralNetwork& net, const Optimizer::ColumnRuns* first_layer_runs = nullptr) const;
+    // Sizes the masks to net's layers unless they fit already. A network
+    // loaded pruned keeps its blocks of zero weights pruned.
+    void buildMasks(const NeuralNetwork& net);
+
+    // Share of blocks pruned in every layer
+    double getSparsity() const
+    {
+        return sparsity;
+    }
+    const PruningSchedule& getSchedule() const
+    {
+        return schedule;
+    }
+    // One byte per block of the layer, [block rows x inputs], 0 when pruned
+    const std::vector<uint8_t>& getMask(size_t layer) const
+    {
+        return masks[layer];
+    }
+
+private:
+    PruningSchedule schedule;
+    std::vector<std::vector<uint8_t>> masks;
+    double sparsity = 0;
+};
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "quantization.h"
+#include "neural_network.h"
+#include "kernels.h"
+
+// Symmetric int8 range, -128 is left out so negation never overflows
+static constexpr Scalar INT8_LIMIT = 127;
+
+static int8_t quantize(Scalar value, Scalar inverse_scale)
+{
+    return (int8_t)std::clamp<Scalar>(std::round(value * inverse_scale), -INT8_LIMIT, INT8_LIMIT);
+}
+
+// Scale so that the largest magnitude maps to INT8_LIMIT, 1 for all zeros
+static Scalar scaleFor(Scalar max_abs)
+{
+    return max_abs > 0 ? max_abs / INT8_LIMIT : 1;
+}
+
+static Scalar maxAbs(const Scalar* values, size_t count)
+{
+    Scalar result = 0;
+    for (size_t i = 0; i < count; ++i)
+        result = std::max(result, std::abs(values[i]));
+    return result;
+}
+
+QuantizedNetwork::QuantizedNetwork(const NeuralNetwork& net, MatrixView<const Scalar> calibration, Granularity granularity)
+    : input_count(net.getInputCount()), loss(net.loss)
+{
+    Workspace workspace;
+    net.forwardBatch(calibration, workspace);
+
+    size_t widest = input_count;
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+    {
+        const Layer& l = net.layers[layer];
+        const Matrix& inputs = workspace.batches[layer - 1].activated_neurons;
+        const Scalar input_scale = scaleFor(maxAbs(inputs.data(), inputs.size()));
+
+        QuantizedLayer q{ BasicMatrix<int8_t>(l.size, l.input_size), l.biases, AlignedVector<Scalar>(l.size), input_scale, l.activation };
+        const Scalar layer_max = maxAbs(l.weights.data(), l.weights.size());
+        for (size_t neuron = 0; neuron < l.size; ++neuron)
+        {
+            const Scalar weight_scale = scaleFor(granularity == Granularity::PER_NEURON ? maxAbs(l.weights[neuron], l.input_size) : layer_max);
+            for (size_t input = 0; input < l.input_size; ++input)
+                q.weights[neuron][input] = quantize(l.weights[neuron][input], 1 / weight_scale);
+            q.output_scales[neuron] = weight_scale * input_scale;
+        }
+        layers.push_back(std::move(q));
+        widest = std::max(widest, l.size);
+    }
+    neurons.resize(widest);
+    activations.resize(widest);
+    quantized_inputs.resize(widest);
+}
+
+QuantizedNetwork::QuantizedNetwork(const NeuralNetwork& net, const std::vector<std::vector<Scalar>>& calibration, Granularity granularity)
+    : QuantizedNetwork(net, [&]
+    {
+        Matrix samples(calibration.size(), net.getInputCount());
+        for (size_t sample = 0; sample < calibration.size(); ++sample)
+            std::copy(calibration[sample].begin(), calibration[sample].end(), samples[sample]);
+        return samples;
+    }().view(), granularity)
+{
+}
+
+std::span<const Scalar> QuantizedNetwork::forward(std::span<const Scalar> inputs)
+{
+    const Kernels& kern = kernels();
+    std::copy(inputs.begin(), inputs.end(), neurons.begin());
+    std::copy(inputs.begin(), inputs.end(), activations.begin());
+    size_t size = inputs.size();
+    for (const auto& layer : layers)
+    {
+        // Inputs outside the calibrated range saturate
+        const Scalar inverse_scale = 1 / layer.input_scale;
+        for (size_t i = 0; i < size; ++i)
+            quantized_inputs[i] = quantize(activations[i], inverse_scale);
+
+        size = layer.weights.rows;
+        for (size_t neuron = 0; neuron < size; ++neuron)
+            neurons[neuron] = layer.biases[neuron] + layer.output_scales[neuron] * (Scalar)kern.dotInt8(layer.weights[neuron], quantized_inputs.data(), layer.weights.cols);
+        layer.activation->apply({ neurons.data(), size }, { activations.data(), size });
+    }
+    return { activations.data(), size };
+}
+
+double QuantizedNetwork::test(const std::vector<Scalar>& inputs, const std::vector<Scalar>& targets)
+{
+    auto outputs = forward(inputs);
+    return loss->evaluate({ neurons.data(), outputs.size() }, outputs, targets);
+}
+
+double QuantizedNetwork::test(const std::vector<std::vector<Scalar>>& inputs, const std::vector<std::vector<Scalar>>& targets)
+{
+    double cost = 0.0;
+    for (size_t i = 0; i < inputs.size(); ++i)
+        cost += test(inputs[i], targets[i]);
+    cost /= inputs.size();
+    return cost;
+}
+
+double QuantizedNetwork::test(const IdxDataset& dataset)
+{
+    std::vector<Scalar> inputs(getInputCount());
+    std::vector<Scalar> targets(getOutputCount());
+    double cost = 0.0;
+    for (size_t sample = 0; sample < dataset.size(); ++sample)
+    {
+        dataset.fillBatch(sample, { inputs.data(), 1, inputs.size() }, { targets.data(), 1, targets.size() });
+        cost += test(inputs, targets);
+    }
+    return cost / dataset.size();
+}
+
+size_t QuantizedNetwork::getParameterMemory() const
+{
+    size_t bytes = 0;
+    for (const auto& layer : layers)
+        bytes += layer.weights.size() + (layer.biases.size() + layer.output_scales.size() + 1) * sizeof(Scalar);
+    return bytes;
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <span>
+#include "activations.h"
+#include "loss.h"
+#include "matrix.h"
+#include "dataset.h"
+
+class NeuralNetwork;
+
+// Post-training int8 version of a network for inference. Weights are stored
+// as int8 with symmetric scales per layer or per output neuron, layer inputs
+// are quantized with a scale calibrated on sample data, and the products
+// accumulate in int32 before being scaled back for bias and activation.
+class QuantizedNetwork
+{
+public:
+    enum class Granularity: uint8_t
+    {
+        PER_LAYER,
+        PER_NEURON
+    };
+
+    // Runs the calibration samples, one per row, through net to find the
+    // range of every layer's inputs
+    QuantizedNetwork(const NeuralNetwork& net, MatrixView<const Scalar> calibration, Granularity granularity = Granularity::PER_NEURON);
+    QuantizedNetwork(const NeuralNetwork& net, const std::vector<std::vector<Scalar>>& calibration, Granularity granularity = Granularity::PER_NEURON);
+
+    // Returns the outputs for one sample, valid until the next call
+    std::span<const Scalar> forward(std::span<const Scalar> inputs);
+
+    // Costs of the source network's loss as in NeuralNetwork::test, the
+    // difference to the float network's result is the accuracy lost to
+    // quantization
+    double test(const std::vector<Scalar>& inputs, const std::vector<Scalar>& targets);
+    double test(const std::vector<std::vector<Scalar>>& inputs, const std::vector<std::vector<Scalar>>& targets);
+    double test(const IdxDataset& dataset);
+
+    size_t getInputCount() const
+    {
+        return input_count;
+    }
+    size_t getOutputCount() const
+    {
+        return layers.empty() ? input_count : layers.back().weights.rows;
+    }
+    // Bytes held by weights, biases and scales
+    size_t getParameterMemory() const;
+
+private:
+    struct QuantizedLayer
+    {
+        BasicMatrix<int8_t> weights;
+        AlignedVector<Scalar> biases;
+        // Maps a row's int32 sum back to real units, weight scale * input scale
+        AlignedVector<Scalar> output_scales;
+        // Real value of one step of the quantized inputs
+        Scalar input_scale;
+        std::shared_ptr<Activation> activation;
+    };
+
+private:
+    std::vector<QuantizedLayer> layers;
+    size_t input_count = 0;
+    std::shared_ptr<Loss> loss;
+    // Pre-activations of the last layer run, the loss may need them
+    AlignedVector<Scalar> neurons;
+    AlignedVector<Scalar> activations;
+    AlignedVector<int8_t> quantized_inputs;
+};
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include "reducer.h"
+#include "neural_network.h"
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared counters need lock-free atomics");
+
+namespace
+{
+constexpr uint64_t SHM_MAGIC = 0x4e4e52494e47ull;
+constexpr size_t SHM_ALIGNMENT = 64;
+
+size_t alignUp(size_t size)
+{
+    return (size + SHM_ALIGNMENT - 1) / SHM_ALIGNMENT * SHM_ALIGNMENT;
+}
+
+// Spins for a short while before giving the core away
+template <typename Condition>
+void waitFor(Condition condition)
+{
+    for (size_t spin = 0; !condition(); ++spin)
+        if (spin >= 64)
+            std::this_thread::yield();
+}
+}
+
+struct ShmRingReducer::Header
+{
+    std::atomic<uint64_t> magic;
+    uint64_t rank_count;
+    uint64_t piece_size;
+    uint64_t scalar_size;
+    std::atomic<uint64_t> joined;
+};
+
+// Counters only grow, each on its own cache line
+struct alignas(SHM_ALIGNMENT) ShmRingReducer::Counter
+{
+    std::atomic<uint64_t> value;
+};
+
+// Memory layout: header, then sent and received counters and the mailbox of every rank
+ShmRingReducer::ShmRingReducer(const std::string& name, size_t rank, size_t rank_count, size_t piece_size)
+    : name(name.starts_with('/') ? name : "/" + name), rank(rank), rank_count(rank_count), piece_size(std::max<size_t>(1, piece_size))
+{
+    if (rank_count == 0 || rank >= rank_count)
+        throw std::invalid_argument("Rank out of range");
+#ifdef _WIN32
+    throw std::runtime_error("Shared memory all-reduce is only supported on POSIX systems");
+#else
+    memory_size = alignUp(sizeof(Header)) + rank_count * (2 * sizeof(Counter) + alignUp(this->piece_size * sizeof(Scalar)));
+
+    int handle = -1;
+    if (rank == 0)
+    {
+        // Leftovers of a crashed run would hold stale counters
+        shm_unlink(this->name.c_str());
+        handle = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (handle < 0 || ftruncate(handle, (off_t)memory_size) != 0)
+        {
+            if (handle >= 0)
+                close(handle);
+            throw std::runtime_error("Cannot create shared memory " + this->name);
+        }
+    }
+    else
+    {
+        // Waits for rank 0 to create it
+        waitFor([&] { return (handle = shm_open(this->name.c_str(), O_RDWR, 0600)) >= 0; });
+        struct stat info;
+        waitFor([&] { return fstat(handle, &info) == 0 && (size_t)info.st_size >= memory_size; });
+    }
+    memory = mmap(nullptr, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+    close(handle);
+    if (memory == MAP_FAILED)
+    {
+        memory = nullptr;
+        throw std::runtime_error("Cannot map shared memory " + this->name);
+    }
+
+    // The new memory is zeroed, so every counter starts at 0
+    Header* header = static_cast<Header*>(memory);
+    if (rank == 0)
+    {
+        header->rank_count = rank_count;
+        header->piece_size = this->piece_size;
+        header->scalar_size = sizeof(Scalar);
+        header->magic.store(SHM_MAGIC, std::memory_order_release);
+    }
+    else
+    {
+        waitFor([&] { return header->magic.load(std::memory_order_acquire) == SHM_MAGIC; });
+        if (header->rank_count != rank_count || header->piece_size != this->piece_size || header->scalar_size != sizeof(Scalar))
+        {
+            munmap(memory, memory_size);
+            memory = nullptr;
+            throw std::runtime_error("Shared memory " + this->name + " was created with other settings");
+        }
+    }
+    header->joined.fetch_add(1, std::memory_order_acq_rel);
+    waitFor([&] { return header->joined.load(std::memory_order_acquire) >= rank_count; });
+    // Everyone has mapped it, the name is no longer needed
+    if (rank == 0)
+        shm_unlink(this->name.c_str());
+
+    thread = std::thread(&ShmRingReducer::communicate, this);
+#endif
+}
+
+ShmRingReducer::~ShmRingReducer()
+{
+    if (thread.joinable())
+    {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+#ifndef _WIN32
+    if (memory)
+        munmap(memory, memory_size);
+#endif
+}
+
+ShmRingReducer::Counter& ShmRingReducer::sent(size_t rank) const
+{
+    return reinterpret_cast<Counter*>(static_cast<char*>(memory) + alignUp(sizeof(Header)))[2 * rank];
+}
+
+ShmRingReducer::Counter& ShmRingReducer::received(size_t rank) const
+{
+    return reinterpret_cast<Counter*>(static_cast<char*>(memory) + alignUp(sizeof(Header)))[2 * rank + 1];
+}
+
+Scalar* ShmRingReducer::mailbox(size_t rank) const
+{
+    char* mailboxes = static_cast<char*>(memory) + alignUp(sizeof(Header)) + rank_count * 2 * sizeof(Counter);
+    return reinterpret_cast<Scalar*>(mailboxes + rank * alignUp(piece_size * sizeof(Scalar)));
+}
+
+void ShmRingReducer::transfer(const Scalar* send_values, size_t send_count, Scalar* receive_values, size_t receive_count, bool accumulate)
+{
+    // Both sides walk the same pieces, and a rank only waits for its
+    // successor to take the piece before, so the ring cannot deadlock
+    const size_t previous = (rank + rank_count - 1) % rank_count;
+    Counter& own_sent = sent(rank);
+    Counter& own_received = received(rank);
+    Counter& previous_sent = sent(previous);
+    Counter& previous_received = received(previous);
+    Scalar* own_mailbox = mailbox(rank);
+    const Scalar* previous_mailbox = mailbox(previous);
+
+    for (size_t offset = 0; offset < std::max(send_count, receive_count); offset += piece_size)
+    {
+        if (offset < send_count)
+        {
+            const size_t size = std::min(piece_size, send_count - offset);
+            const uint64_t pieces_sent = own_sent.value.load(std::memory_order_relaxed);
+            waitFor([&] { return own_received.value.load(std::memory_order_acquire) == pieces_sent; });
+            std::memcpy(own_mailbox, send_values + offset, size * sizeof(Scalar));
+            own_sent.value.store(pieces_sent + 1, std::memory_order_release);
+        }
+        if (offset < receive_count)
+        {
+            const size_t size = std::min(piece_size, receive_count - offset);
+            waitFor([&] { return previous_sent.value.load(std::memory_order_acquire) > pieces_received; });
+            Scalar* target = receive_values + offset;
+            if (accumulate)
+                for (size_t i = 0; i < size; ++i)
+                    target[i] += previous_mailbox[i];
+            else
+                std::memcpy(target, previous_mailbox, size * sizeof(Scalar));
+            previous_received.value.store(++pieces_received, std::memory_order_release);
+        }
+    }
+}
+
+void ShmRingReducer::allReduce(Scalar* values, size_t count)
+{
+    if (rank_count == 1 || count == 0)
+        return;
+    auto chunk = [&](size_t index) { return values + count * (index % rank_count) / rank_count; };
+    auto chunkSize = [&](size_t index)
+    {
+        index %= rank_count;
+        return count * (index + 1) / rank_count - count * index / rank_count;
+    };
+
+    // Reduce-scatter: after rank_count - 1 steps rank r holds the full sum
+    // of chunk r + 1. Sender and receiver agree on the chunk sizes of a step,
+    // because the chunk rank r sends is the one rank r + 1 receives.
+    const size_t ring = rank + rank_count;
+    for (size_t step = 0; step + 1 < rank_count; ++step)
+    {
+        const size_t send_chunk = ring - step;
+        const size_t receive_chunk = ring - step - 1;
+        transfer(chunk(send_chunk), chunkSize(send_chunk), chunk(receive_chunk), chunkSize(receive_chunk), true);
+    }
+    // All-gather: the summed chunks go round the ring once more
+    for (size_t step = 0; step + 1 < rank_count; ++step)
+    {
+        const size_t send_chunk = ring + 1 - step;
+        const size_t receive_chunk = ring - step;
+        transfer(chunk(send_chunk), chunkSize(send_chunk), chunk(receive_chunk), chunkSize(receive_chunk), false);
+    }
+}
+
+void ShmRingReducer::layerReady(NeuralNetwork& net, size_t layer)
+{
+    {
+        std::lock_guard lock(mutex);
+        ready_layers.emplace_back(&net, layer);
+        ++layers_in_flight;
+    }
+    wake.notify_one();
+}
+
+void ShmRingReducer::finish(NeuralNetwork&)
+{
+    std::unique_lock lock(mutex);
+    done.wait(lock, [&] { return layers_in_flight == 0; });
+    if (error)
+        std::rethrow_exception(std::exchange(error, nullptr));
+}
+
+void ShmRingReducer::communicate()
+{
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        wake.wait(lock, [&] { return stopping || !ready_layers.empty(); });
+        if (ready_layers.empty())
+            return;
+        const auto [net, layer] = ready_layers.front();
+        ready_layers.pop_front();
+        lock.unlock();
+        try
+        {
+            NN_PROFILE_SCOPE("all_reduce");
+            Layer& l = net->layers[layer];
+            allReduce(l.delta_weights.data(), l.delta_weights.size());
+            allReduce(l.delta_biases.data(), l.delta_biases.size());
+        }
+        catch (...)
+        {
+            std::lock_guard error_lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+        lock.lock();
+        if (--layers_in_flight == 0)
+            done.notify_all();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "scalar.h"
+
+class NeuralNetwork;
+
+// Combines the gradients of several training processes before every
+// optimizer step, see NeuralNetwork::setGradientReducer. Each process
+// trains on its own shard, and every one of them has to take the same
+// steps so that their weights stay identical.
+class GradientReducer
+{
+public:
+    virtual ~GradientReducer() = default;
+
+    // Called for every layer from the output down as soon as its gradients
+    // of the current step are complete, reducing may start in the background
+    // while earlier layers are still being computed. With several training
+    // threads it runs on whichever one completed the layer, one call at a time.
+    virtual void layerReady(NeuralNetwork& net, size_t layer) = 0;
+    // Returns once every layer's gradients hold their sum over all processes
+    virtual void finish(NeuralNetwork& net) = 0;
+};
+
+// Ring all-reduce between rank_count processes of one host through POSIX
+// shared memory. Rank r passes chunks to rank r + 1 through a mailbox of
+// piece_size scalars, so every rank sends and receives about twice its
+// gradients per step whatever the number of ranks. Each chunk is summed on
+// one rank and copied to the others, so every rank ends with the same bits.
+//
+// All ranks open the same name, rank 0 creates the memory and the
+// constructors return once every rank has joined. A rank that dies leaves
+// the others waiting.
+class ShmRingReducer: public GradientReducer
+{
+public:
+    ShmRingReducer(const std::string& name, size_t rank, size_t rank_count, size_t piece_size = 1 << 15);
+    ~ShmRingReducer() override;
+
+    ShmRingReducer(const ShmRingReducer&) = delete;
+    ShmRingReducer& operator=(const ShmRingReducer&) = delete;
+
+    // Layers are reduced on a thread of the reducer in the order they are ready
+    void layerReady(NeuralNetwork& net, size_t layer) override;
+    void finish(NeuralNetwork& net) override;
+
+    // Replaces values with their sum over all ranks, every rank has to call
+    // it with the same count
+    void allReduce(Scalar* values, size_t count);
+
+    size_t getRank() const
+    {
+        return rank;
+    }
+    size_t getRankCount() const
+    {
+        return rank_count;
+    }
+
+private:
+    struct Header;
+    struct Counter;
+
+    // Passes send_count values to the next rank while taking receive_count
+    // values from the previous one, adding them or replacing, piece by piece
+    void transfer(const Scalar* send_values, size_t send_count, Scalar* receive_values, size_t receive_count, bool accumulate);
+    // Reduces the gradients of the layers handed to layerReady
+    void communicate();
+
+    Counter& sent(size_t rank) const;
+    Counter& received(size_t rank) const;
+    Scalar* mailbox(size_t rank) const;
+
+private:
+    const std::string name;
+    const size_t rank;
+    const size_t rank_count;
+    const size_t piece_size;
+    void* memory = nullptr;
+    size_t memory_size = 0;
+    // Pieces taken from the previous rank's mailbox so far
+    uint64_t pieces_received = 0;
+
+    std::deque<std::pair<NeuralNetwork*, size_t>> ready_layers;
+    size_t layers_in_flight = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::thread thread;
+};
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <iostream>
+
+// Floating point type used for every weight, activation and gradient.
+// Configure with -DNN_FLOAT=ON to train and run networks in float32.
+#ifdef NN_FLOAT
+using Scalar = float;
+#else
+using Scalar = double;
+#endif
+
+enum class Precision: uint8_t
+{
+    FLOAT32,
+    FLOAT64
+};
+
+inline constexpr Precision SCALAR_PRECISION = sizeof(Scalar) == sizeof(float) ? Precision::FLOAT32 : Precision::FLOAT64;
+
+// Reads count values stored with the given precision, converting them to Scalar
+inline void readScalars(std::istream& is, Scalar* values, size_t count, Precision precision)
+{
+    if (precision == SCALAR_PRECISION)
+    {
+        is.read((char*)values, count * sizeof(Scalar));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (precision == Precision::FLOAT32)
+        {
+            float value;
+            is.read((char*)&value, sizeof(value));
+            values[i] = (Scalar)value;
+        }
+        else
+        {
+            double value;
+            is.read((char*)&value, sizeof(value));
+            values[i] = (Scalar)value;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "sparse.h"
+#include <algorithm>
+
+SparseBatch SparseBatch::fromDense(MatrixView<const Scalar> dense)
+{
+    SparseBatch batch(dense.cols);
+    std::vector<uint32_t> row_indices;
+    std::vector<Scalar> row_values;
+    for (size_t row = 0; row < dense.rows; ++row)
+    {
+        row_indices.clear();
+        row_values.clear();
+        for (size_t col = 0; col < dense.cols; ++col)
+        {
+            if (dense[row][col] != 0)
+            {
+                row_indices.push_back((uint32_t)col);
+                row_values.push_back(dense[row][col]);
+            }
+        }
+        batch.addRow(row_indices, row_values);
+    }
+    // Binary inputs need no values at all
+    if (std::all_of(batch.values.begin(), batch.values.end(), [](Scalar value) { return value == 1; }))
+        batch.values.clear();
+    return batch;
+}
+
+void SparseBatch::addRow(std::span<const uint32_t> row_indices, std::span<const Scalar> row_values)
+{
+    if (!row_values.empty() && values.empty())
+        values.assign(indices.size(), 1);
+
+    indices.insert(indices.end(), row_indices.begin(), row_indices.end());
+    if (!row_values.empty())
+        values.insert(values.end(), row_values.begin(), row_values.end());
+    else if (!values.empty())
+        values.resize(indices.size(), 1);
+    row_offsets.push_back((uint32_t)indices.size());
+}
+
+SparseBatch SparseBatch::slice(size_t first, size_t count) const
+{
+    SparseBatch batch(cols);
+    const uint32_t begin = row_offsets[first];
+    const uint32_t end = row_offsets[first + count];
+    batch.row_offsets.resize(count + 1);
+    for (size_t row = 0; row <= count; ++row)
+        batch.row_offsets[row] = row_offsets[first + row] - begin;
+    batch.indices.assign(indices.begin() + begin, indices.begin() + end);
+    if (!values.empty())
+        batch.values.assign(values.begin() + begin, values.begin() + end);
+    return batch;
+}
+
+std::vector<uint32_t> SparseBatch::activeColumns() const
+{
+    // Few entries are sorted, otherwise a mask over the columns is cheaper
+    if (indices.size() * 16 < cols)
+    {
+        std::vector<uint32_t> columns(indices);
+        std::sort(columns.begin(), columns.end());
+        columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+        return columns;
+    }
+    std::vector<uint8_t> active(cols, 0);
+    size_t count = 0;
+    for (uint32_t index : indices)
+    {
+        count += !active[index];
+        active[index] = 1;
+    }
+    std::vector<uint32_t> columns;
+    columns.reserve(count);
+    for (size_t col = 0; col < cols; ++col)
+        if (active[col])
+            columns.push_back((uint32_t)col);
+    return columns;
+}
+
+BlockSparseMatrix BlockSparseMatrix::fromDense(MatrixView<const Scalar> dense)
+{
+    BlockSparseMatrix matrix;
+    matrix.rows = dense.rows;
+    matrix.cols = dense.cols;
+    for (size_t first = 0; first < dense.rows; first += BLOCK_ROWS)
+    {
+        const size_t count = std::min(BLOCK_ROWS, dense.rows - first);
+        for (size_t col = 0; col < dense.cols; ++col)
+        {
+            bool zero = true;
+            for (size_t row = 0; row < count; ++row)
+                zero &= dense[first + row][col] == 0;
+            if (zero)
+                continue;
+            matrix.columns.push_back((uint32_t)col);
+            for (size_t row = 0; row < BLOCK_ROWS; ++row)
+                matrix.values.push_back(row < count ? dense[first + row][col] : 0);
+        }
+        matrix.row_offsets.push_back((uint32_t)matrix.columns.size());
+    }
+    return matrix;
+}
+
+void BlockSparseMatrix::multiplyAdd(const Scalar* x, Scalar* y) const
+{
+    multiplyAdd(MatrixView<const Scalar>(x, 1, cols), MatrixView<Scalar>(y, 1, rows));
+}
+
+void BlockSparseMatrix::multiplyAdd(MatrixView<const Scalar> x, MatrixView<Scalar> y) const
+{
+    const Kernels& kern = kernels();
+    // Block rows outside, so each one stays in cache while every sample reads it
+    for (size_t block_row = 0; block_row < blockRows(); ++block_row)
+    {
+        const size_t first = block_row * BLOCK_ROWS;
+        const size_t count = std::min(BLOCK_ROWS, rows - first);
+        const size_t offset = row_offsets[block_row];
+        const size_t block_count = row_offsets[block_row + 1] - offset;
+        for (size_t sample = 0; sample < x.rows; ++sample)
+        {
+            if (count == BLOCK_ROWS)
+            {
+                kern.sparseBlockRow(values.data() + offset * BLOCK_ROWS, columns.data() + offset, block_count, x[sample], y[sample] + first);
+            }
+            else
+            {
+                // The padding rows would run into the next sample
+                Scalar tail[BLOCK_ROWS] = {};
+                kern.sparseBlockRow(values.data() + offset * BLOCK_ROWS, columns.data() + offset, block_count, x[sample], tail);
+                for (size_t row = 0; row < count; ++row)
+                    y[sample][first + row] += tail[row];
+            }
+        }
+    }
+}
\ No newline at end of file
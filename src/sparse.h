@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <cstdint>
+#include "matrix.h"
+#include "kernels.h"
+
+// [rows x cols] batch in compressed sparse row form, for inputs that are
+// mostly zero such as binarized images, bag-of-words or one-hot features.
+// Row r holds the entries row_offsets[r] .. row_offsets[r + 1] of indices
+// and values. values stays empty while every entry is 1.
+struct SparseBatch
+{
+    explicit SparseBatch(size_t cols = 0)
+        : cols(cols)
+    {}
+
+    // Dense rows to sparse, entries equal to zero are dropped
+    static SparseBatch fromDense(MatrixView<const Scalar> dense);
+
+    void clear()
+    {
+        row_offsets.assign(1, 0);
+        indices.clear();
+        values.clear();
+    }
+    // Appends a row, row_values may be left empty for an all-ones row
+    void addRow(std::span<const uint32_t> row_indices, std::span<const Scalar> row_values = {});
+
+    size_t rows() const
+    {
+        return row_offsets.size() - 1;
+    }
+    size_t nonZeros() const
+    {
+        return indices.size();
+    }
+    bool isBinary() const
+    {
+        return values.empty();
+    }
+    std::span<const uint32_t> rowIndices(size_t row) const
+    {
+        return { indices.data() + row_offsets[row], row_offsets[row + 1] - row_offsets[row] };
+    }
+    // Values of a row, only valid when the batch is not binary
+    std::span<const Scalar> rowValues(size_t row) const
+    {
+        return { values.data() + row_offsets[row], row_offsets[row + 1] - row_offsets[row] };
+    }
+
+    // Copy of the rows first .. first + count
+    SparseBatch slice(size_t first, size_t count) const;
+
+    // Sorted distinct columns with an entry in any row
+    std::vector<uint32_t> activeColumns() const;
+
+    size_t cols;
+    std::vector<uint32_t> row_offsets = { 0 };
+    std::vector<uint32_t> indices;
+    std::vector<Scalar> values;
+};
+
+// [rows x cols] weight matrix stored as blocks of BLOCK_ROWS consecutive rows
+// by one column, the pattern Pruner leaves behind. Block row r holds the
+// blocks row_offsets[r] .. row_offsets[r + 1] of columns, their BLOCK_ROWS
+// values each are contiguous in values. Blocks that are entirely zero are
+// left out, the last block row is padded with zero rows.
+struct BlockSparseMatrix
+{
+    static constexpr size_t BLOCK_ROWS = Kernels::SPARSE_BLOCK_ROWS;
+
+    static BlockSparseMatrix fromDense(MatrixView<const Scalar> dense);
+
+    // y[row] += sum(this[row][col] * x[col]), y holds rows values
+    void multiplyAdd(const Scalar* x, Scalar* y) const;
+    // Same for every row of x, y: [x.rows x rows]
+    void multiplyAdd(MatrixView<const Scalar> x, MatrixView<Scalar> y) const;
+
+    size_t blockRows() const
+    {
+        return row_offsets.size() - 1;
+    }
+    size_t blockCount() const
+    {
+        return columns.size();
+    }
+    // Share of the blocks that are stored
+    double density() const
+    {
+        return blockRows() * cols != 0 ? double(blockCount()) / double(blockRows() * cols) : 1;
+    }
+    size_t getMemoryUsage() const
+    {
+        return row_offsets.size() * sizeof(uint32_t) + columns.size() * sizeof(uint32_t) + values.size() * sizeof(Scalar);
+    }
+
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<uint32_t> row_offsets = { 0 };
+    std::vector<uint32_t> columns;
+    AlignedVector<Scalar> values;
+};
\ No newline at end of file
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include "activations.h"
+#include "neural_network.h"
+
+// Layer spec of a StaticNetwork
+template <size_t Size, typename A = Relu>
+struct Dense
+{
+    static constexpr size_t size = Size;
+    using Activation = A;
+};
+
+// Dense layer with its sizes known at compile time. Parameters live in
+// std::array and the activation is called without virtual dispatch.
+template <size_t InputSize, size_t Size, typename A>
+struct StaticLayer
+{
+    static constexpr size_t input_size = InputSize;
+    static constexpr size_t size = Size;
+    using Inputs = std::array<Scalar, InputSize>;
+    using Outputs = std::array<Scalar, Size>;
+
+    StaticLayer() = default;
+    explicit StaticLayer(const Layer& layer)
+        : activation(checked(layer))
+    {
+        std::copy(layer.weights.values.begin(), layer.weights.values.end(), weights.begin());
+        std::copy(layer.biases.begin(), layer.biases.end(), biases.begin());
+    }
+
+    void forward(const Inputs& inputs, Outputs& outputs) const
+    {
+        for (size_t neuron = 0; neuron < Size; ++neuron)
+        {
+            Scalar sum = biases[neuron];
+            for (size_t input = 0; input < InputSize; ++input)
+                sum += weights[neuron * InputSize + input] * inputs[input];
+            outputs[neuron] = sum;
+        }
+        activation.A::apply(outputs, outputs);
+    }
+
+    // Activation of a layer with this topology, parameters included
+    static const A& checked(const Layer& layer)
+    {
+        if (layer.size != Size || layer.input_size != InputSize || layer.activation->type != A().type)
+            throw std::invalid_argument("Layer does not match the static topology");
+        return static_cast<const A&>(*layer.activation);
+    }
+
+    std::array<Scalar, Size * InputSize> weights{};
+    Outputs biases{};
+    A activation;
+};
+
+// Network whose topology is fixed at compile time, for tiny models where
+// allocation and virtual calls dominate. The sizes are constants, so the
+// compiler can unroll every loop, and forward never allocates:
+//
+//   StaticNetwork<2, Dense<2, Relu>, Dense<1, Linear>> net(trained_net);
+//   Scalar y = net.forward({ 0, 1 })[0];
+//
+// It reads and writes the NeuralNetwork file format.
+template <size_t InputSize, typename... Specs>
+class StaticNetwork
+{
+    // Chains the specs into layers, each taking the previous one's size as input
+    template <size_t In, typename... Rest>
+    struct Build
+    {
+        using Type = std::tuple<>;
+    };
+    template <size_t In, typename First, typename... Rest>
+    struct Build<In, First, Rest...>
+    {
+        using Type = decltype(std::tuple_cat(std::declval<std::tuple<StaticLayer<In, First::size, typename First::Activation>>>(),
+                                             std::declval<typename Build<First::size, Rest...>::Type>()));
+    };
+
+public:
+    using Layers = typename Build<InputSize, Specs...>::Type;
+    static constexpr size_t layer_count = sizeof...(Specs);
+    static_assert(layer_count > 0, "A static network needs at least one layer");
+
+    template <size_t I>
+    using LayerAt = std::tuple_element_t<I, Layers>;
+    using Inputs = std::array<Scalar, InputSize>;
+    using Outputs = typename LayerAt<layer_count - 1>::Outputs;
+
+    StaticNetwork() = default;
+    // Copies the parameters of a runtime network with the same topology,
+    // throws std::invalid_argument if sizes or activations differ
+    explicit StaticNetwork(const NeuralNetwork& net)
+        : StaticNetwork(checked(net), std::make_index_sequence<layer_count>())
+    {
+    }
+
+    const Outputs& forward(const Inputs& inputs)
+    {
+        return forwardFrom<0>(inputs);
+    }
+
+    // Builds a runtime network with the same parameters into net, e.g. to
+    // continue training. net must be empty.
+    void toNetwork(NeuralNetwork& net) const
+    {
+        net.add<Linear>(InputSize);
+        addLayers(net, std::make_index_sequence<layer_count>());
+        net.template setOptimizer<Gd>();
+    }
+
+    void save(std::ostream& os) const
+    {
+        NeuralNetwork net;
+        toNetwork(net);
+        os << net;
+    }
+    static StaticNetwork load(std::istream& is)
+    {
+        NeuralNetwork net;
+        is >> net;
+        return StaticNetwork(net);
+    }
+
+    Layers layers;
+
+private:
+    template <size_t... I>
+    StaticNetwork(const NeuralNetwork& net, std::index_sequence<I...>)
+        : layers(LayerAt<I>(net.layers[I + 1])...)
+    {
+    }
+
+    static const NeuralNetwork& checked(const NeuralNetwork& net)
+    {
+        if (net.getLayerCount() != layer_count + 1 || net.getInputCount() != InputSize)
+            throw std::invalid_argument("Network does not match the static topology");
+        return net;
+    }
+
+    template <size_t I>
+    const Outputs& forwardFrom(const typename LayerAt<I>::Inputs& inputs)
+    {
+        auto& outputs = std::get<I>(activations);
+        std::get<I>(layers).forward(inputs, outputs);
+        if constexpr (I + 1 < layer_count)
+            return forwardFrom<I + 1>(outputs);
+        else
+            return outputs;
+    }
+
+    template <size_t... I>
+    void addLayers(NeuralNetwork& net, std::index_sequence<I...>) const
+    {
+        (addLayer<I>(net), ...);
+    }
+    template <size_t I>
+    void addLayer(NeuralNetwork& net) const
+    {
+        const auto& layer = std::get<I>(layers);
+        using A = decltype(layer.activation);
+        net.template add<A>(layer.size, layer.activation);
+        Layer& added = net.layers.back();
+        std::copy(layer.weights.begin(), layer.weights.end(), added.weights.values.begin());
+        std::copy(layer.biases.begin(), layer.biases.end(), added.biases.begin());
+    }
+
+private:
+    // Outputs of every layer, the whole network is a few cache lines for the
+    // sizes this is meant for
+    template <typename... L>
+    static std::tuple<typename L::Outputs...> outputsOf(std::tuple<L...>*);
+    decltype(outputsOf((Layers*)nullptr)) activations{};
+};
\ No newline at end of file
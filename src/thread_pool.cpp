@@ -0,0 +1,151 @@
+#include "thread_pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Index of the queue owned by the running thread within its pool
+static thread_local const ThreadPool* current_pool = nullptr;
+static thread_local size_t current_queue = 0;
+
+static void pinThread(std::thread& thread, size_t cpu)
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+}
+
+ThreadPool::ThreadPool(size_t thread_count, const std::vector<size_t>& cpus)
+{
+    thread_count = std::max<size_t>(thread_count, 1);
+    for (size_t queue = 0; queue < thread_count; ++queue)
+        queues.push_back(std::make_unique<Queue>());
+    for (size_t worker = 0; worker + 1 < thread_count; ++worker)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, worker + 1);
+        if (cpus.size())
+            pinThread(workers.back(), cpus[worker % cpus.size()]);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const RangeFunction& f)
+{
+    if (!count)
+        return;
+    grain = std::max<size_t>(grain, 1);
+    // A few tasks per thread leave room for stealing when ranges run unevenly
+    const size_t task_count = std::min((count + grain - 1) / grain, queues.size() * 4);
+
+    Job job{ &f, task_count };
+    const size_t home = currentQueue();
+    {
+        // Counted before pushing so a fast worker never takes pending below zero
+        std::lock_guard lock(sleep_mutex);
+        pending += task_count;
+    }
+    for (size_t task = 0; task < task_count; ++task)
+    {
+        // Spread the tasks over all queues so idle workers start without stealing
+        Queue& queue = *queues[(home + task) % queues.size()];
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back({ &job, count * task / task_count, count * (task + 1) / task_count });
+    }
+    wake.notify_all();
+
+    // Help out until every task of this job is done
+    Task task;
+    while (job.remaining.load(std::memory_order_acquire))
+    {
+        if (popTask(home, task) || stealTask(home, task))
+            execute(task);
+        else
+            std::this_thread::yield();
+    }
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+    current_pool = this;
+    current_queue = index;
+    Task task;
+    while (true)
+    {
+        if (popTask(index, task) || stealTask(index, task))
+        {
+            execute(task);
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex);
+        wake.wait(lock, [this] { return stopping || pending.load(); });
+        if (stopping)
+            return;
+    }
+}
+
+bool ThreadPool::popTask(size_t index, Task& task)
+{
+    Queue& queue = *queues[index];
+    std::lock_guard lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::stealTask(size_t index, Task& task)
+{
+    for (size_t offset = 1; offset < queues.size(); ++offset)
+    {
+        Queue& queue = *queues[(index + offset) % queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::execute(const Task& task)
+{
+    pending.fetch_sub(1);
+    try
+    {
+        (*task.job->function)(task.begin, task.end);
+    }
+    catch (...)
+    {
+        if (!task.job->failed.exchange(true))
+            task.job->error = std::current_exception();
+    }
+    // The release publishes error to parallelFor
+    task.job->remaining.fetch_sub(1, std::memory_order_release);
+}
+
+size_t ThreadPool::currentQueue() const
+{
+    return current_pool == this ? current_queue : 0;
+}
\ No newline at end of file
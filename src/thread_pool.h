@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+// Work-stealing pool for splitting loops over cores. Every worker owns a
+// task deque, pops its own tasks from the front and steals from the back of
+// the others once it runs dry. The thread calling parallelFor executes tasks
+// as well, so nested calls from inside a task cannot deadlock.
+class ThreadPool
+{
+public:
+    using RangeFunction = std::function<void(size_t begin, size_t end)>;
+
+    // thread_count includes the calling thread, so thread_count - 1 workers
+    // are started. A non-empty cpus list pins worker i to cpus[i % cpus.size()].
+    ThreadPool(size_t thread_count = std::thread::hardware_concurrency(), const std::vector<size_t>& cpus = {});
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs f over [0, count) split into ranges of at least grain items and
+    // returns once all of them finished. If f throws, the other ranges still
+    // run and the first exception is rethrown here.
+    void parallelFor(size_t count, size_t grain, const RangeFunction& f);
+
+    size_t getThreadCount() const
+    {
+        return queues.size();
+    }
+
+private:
+    struct Job
+    {
+        const RangeFunction* function;
+        std::atomic<size_t> remaining;
+        // First exception thrown by function, set by whoever sets failed
+        std::atomic<bool> failed = false;
+        std::exception_ptr error = nullptr;
+    };
+    struct Task
+    {
+        Job* job;
+        size_t begin;
+        size_t end;
+    };
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(size_t index);
+    bool popTask(size_t index, Task& task);
+    bool stealTask(size_t index, Task& task);
+    void execute(const Task& task);
+    size_t currentQueue() const;
+
+private:
+    // Queue 0 belongs to threads outside the pool, queue i + 1 to worker i
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> pending = 0;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+// Runs on the pool when there is one and inline otherwise
+inline void parallelFor(ThreadPool* pool, size_t count, size_t grain, const ThreadPool::RangeFunction& f)
+{
+    if (pool && count > grain)
+        pool->parallelFor(count, grain, f);
+    else if (count)
+        f(0, count);
+}
\ No newline at end of file
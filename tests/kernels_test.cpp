@@ -0,0 +1,161 @@
+// Runs every kernel table the CPU supports against the scalar one on random
+// inputs whose sizes are not multiples of any vector width, so the tails are
+// covered too. Results have to agree within a few ULP of their magnitude,
+// the int8 dot product exactly.
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include "kernels.h"
+#include "random.h"
+
+static constexpr Scalar EPSILON = std::numeric_limits<Scalar>::epsilon();
+static constexpr size_t SIZES[] = { 1, 3, 7, 13, 31, 67, 257, 1031 };
+
+static size_t failures = 0;
+
+// |actual - expected| within ulps units in the last place of magnitude
+static void check(const std::string& what, Scalar actual, Scalar expected, Scalar magnitude, Scalar ulps)
+{
+    const Scalar tolerance = ulps * EPSILON * std::max(std::abs(magnitude), std::numeric_limits<Scalar>::min());
+    if (std::abs(actual - expected) <= tolerance)
+        return;
+    if (failures++ < 20)
+        std::cerr << what << ": " << actual << " != " << expected << " (tolerance " << tolerance << ")\n";
+}
+
+static std::vector<Scalar> random(size_t n, Scalar low, Scalar high)
+{
+    std::vector<Scalar> values(n);
+    for (auto& value : values)
+        value = low + (high - low) * (Scalar)Random::Float();
+    return values;
+}
+
+static void testTable(const Kernels& ref, const Kernels& kern)
+{
+    const std::string isa = kern.name;
+    for (size_t n : SIZES)
+    {
+        const std::string at = isa + " n=" + std::to_string(n) + " ";
+        const auto a = random(n, -1, 1);
+        const auto b = random(n, -1, 1);
+
+        // Sums are reordered across lanes, the bound grows with n
+        Scalar magnitude = 0;
+        for (size_t i = 0; i < n; ++i)
+            magnitude += std::abs(a[i] * b[i]);
+        check(at + "dot", kern.dot(a.data(), b.data(), n), ref.dot(a.data(), b.data(), n), magnitude, Scalar(n));
+
+        auto y = b;
+        auto y_ref = b;
+        kern.axpy(Scalar(0.7), a.data(), y.data(), n);
+        ref.axpy(Scalar(0.7), a.data(), y_ref.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            check(at + "axpy", y[i], y_ref[i], 1, 2);
+
+        // Optimizer steps, deltas have to come back cleared
+        auto weights = a;
+        auto weights_ref = a;
+        auto deltas = b;
+        auto deltas_ref = b;
+        kern.gd(weights.data(), deltas.data(), Scalar(0.01), n);
+        ref.gd(weights_ref.data(), deltas_ref.data(), Scalar(0.01), n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            check(at + "gd", weights[i], weights_ref[i], 1, 2);
+            check(at + "gd deltas", deltas[i], 0, 0, 0);
+        }
+
+        auto velocities = random(n, -1, 1);
+        auto velocities_ref = velocities;
+        deltas = b;
+        deltas_ref = b;
+        kern.sgd(weights.data(), velocities.data(), deltas.data(), Scalar(0.01), Scalar(0.9), n);
+        ref.sgd(weights_ref.data(), velocities_ref.data(), deltas_ref.data(), Scalar(0.01), Scalar(0.9), n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            check(at + "sgd velocities", velocities[i], velocities_ref[i], 1, 4);
+            check(at + "sgd", weights[i], weights_ref[i], 1, 4);
+        }
+
+        auto squares = random(n, 0, 1);
+        auto squares_ref = squares;
+        deltas = b;
+        deltas_ref = b;
+        kern.adam(weights.data(), velocities.data(), squares.data(), deltas.data(), Scalar(0.001), Scalar(0.9), Scalar(0.999), Scalar(1e-7), n);
+        ref.adam(weights_ref.data(), velocities_ref.data(), squares_ref.data(), deltas_ref.data(), Scalar(0.001), Scalar(0.9), Scalar(0.999), Scalar(1e-7), n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            check(at + "adam velocities", velocities[i], velocities_ref[i], 1, 4);
+            check(at + "adam squares", squares[i], squares_ref[i], 1, 4);
+            check(at + "adam", weights[i], weights_ref[i], 1, 8);
+        }
+
+        std::vector<int8_t> a8(n);
+        std::vector<int8_t> b8(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            a8[i] = int8_t(Random::Uint() % 255 - 127);
+            b8[i] = int8_t(Random::Uint() % 255 - 127);
+        }
+        if (kern.dotInt8(a8.data(), b8.data(), n) != ref.dotInt8(a8.data(), b8.data(), n) && failures++ < 20)
+            std::cerr << at << "dotInt8 differs\n";
+
+        // Block rows of a block-sparse matrix with n blocks over 2n inputs
+        const auto x = random(2 * n, -1, 1);
+        const auto block_values = random(n * Kernels::SPARSE_BLOCK_ROWS, -1, 1);
+        std::vector<uint32_t> columns(n);
+        for (size_t block = 0; block < n; ++block)
+            columns[block] = uint32_t(Random::Uint() % (2 * n));
+        std::vector<Scalar> rows(Kernels::SPARSE_BLOCK_ROWS, 1);
+        std::vector<Scalar> rows_ref(Kernels::SPARSE_BLOCK_ROWS, 1);
+        kern.sparseBlockRow(block_values.data(), columns.data(), n, x.data(), rows.data());
+        ref.sparseBlockRow(block_values.data(), columns.data(), n, x.data(), rows_ref.data());
+        for (size_t row = 0; row < Kernels::SPARSE_BLOCK_ROWS; ++row)
+            check(at + "sparseBlockRow", rows[row], rows_ref[row], Scalar(n + 1), Scalar(n));
+
+        // Elementwise math within its documented accuracy, inputs kept
+        // inside the range where exp is not clamped
+        const Scalar limit = SCALAR_PRECISION == Precision::FLOAT32 ? 80 : 700;
+        const auto inputs = random(n, -limit, limit);
+        const auto small_inputs = random(n, -20, 20);
+        std::vector<Scalar> out(n);
+        std::vector<Scalar> out_ref(n);
+        kern.exp(inputs.data(), out.data(), n);
+        ref.exp(inputs.data(), out_ref.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            check(at + "exp", out[i], out_ref[i], out_ref[i], 8);
+        kern.sigmoid(small_inputs.data(), out.data(), n);
+        ref.sigmoid(small_inputs.data(), out_ref.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            check(at + "sigmoid", out[i], out_ref[i], 1, 4);
+        kern.tanh(small_inputs.data(), out.data(), n);
+        ref.tanh(small_inputs.data(), out_ref.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            check(at + "tanh", out[i], out_ref[i], 1, 4);
+        kern.softplus(small_inputs.data(), out.data(), n);
+        ref.softplus(small_inputs.data(), out_ref.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            check(at + "softplus", out[i], out_ref[i], std::max(std::abs(small_inputs[i]), Scalar(1)), 8);
+    }
+}
+
+int main()
+{
+    const Kernels& ref = *kernelsFor(Kernels::Isa::SCALAR);
+    for (auto isa : { Kernels::Isa::SSE4, Kernels::Isa::AVX2, Kernels::Isa::AVX512 })
+    {
+        const Kernels* kern = kernelsFor(isa);
+        if (!kern)
+            continue;
+        testTable(ref, *kern);
+        std::cerr << kern->name << " checked\n";
+    }
+    if (failures)
+        std::cerr << failures << " mismatches\n";
+    return failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,142 @@
+// Forks RANKS processes that train one network together through a
+// ShmRingReducer, each on its own batches, and checks that all of them end
+// with the same weights byte for byte. A tiny piece size splits every layer's
+// chunks over several pieces. Dense and sparse batches run with one and with
+// several threads, and one rank gets an empty batch now and then.
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "neural_network.h"
+#include "random.h"
+
+static constexpr size_t RANKS = 3;
+static constexpr size_t STEPS = 4;
+static constexpr size_t ROWS = 10;
+static constexpr size_t INPUTS = 12;
+static constexpr size_t OUTPUTS = 3;
+
+// Weights and biases of every layer after training in one mode
+static std::vector<char> train(const std::string& name, size_t rank, bool sparse, size_t threads)
+{
+    NeuralNetwork net;
+    net.add(INPUTS);
+    net.add<Tanh>(16);
+    net.add<Relu>(8);
+    net.add<Linear>(OUTPUTS);
+    Random::seed = 1;
+    net.initWeights();
+    net.setOptimizer<Adam>();
+    net.setThreadCount(threads);
+    net.setGradientReducer(std::make_shared<ShmRingReducer>(name, rank, RANKS, 5));
+
+    Random::seed = 100 + rank;
+    for (size_t step = 1; step <= STEPS; ++step)
+    {
+        const size_t rows = rank == 2 && step == 2 ? 0 : ROWS;
+        Matrix inputs(rows, INPUTS);
+        Matrix targets(rows, OUTPUTS);
+        // Half the inputs are zero, so the sparse batches differ in their active columns
+        for (Scalar& value : inputs.values)
+            value = Random::Bool() ? (Scalar)Random::Float() : 0;
+        for (Scalar& value : targets.values)
+            value = (Scalar)Random::Float();
+        if (sparse)
+            net.trainBatch(SparseBatch::fromDense(inputs.view()), targets.view(), step);
+        else
+            net.trainBatch(inputs.view(), targets.view(), step);
+    }
+
+    std::vector<char> bytes;
+    for (size_t layer = 1; layer < net.getLayerCount(); ++layer)
+    {
+        const Layer& l = net.layers[layer];
+        bytes.insert(bytes.end(), (const char*)l.weights.data(), (const char*)(l.weights.data() + l.weights.size()));
+        bytes.insert(bytes.end(), (const char*)l.biases.data(), (const char*)(l.biases.data() + l.biases.size()));
+    }
+    return bytes;
+}
+
+int main()
+{
+    const std::string prefix = "nn_reducer_test_" + std::to_string(getpid()) + "_";
+    std::vector<pid_t> children;
+    std::vector<int> pipes;
+    for (size_t rank = 0; rank < RANKS; ++rank)
+    {
+        int ends[2];
+        if (pipe(ends) != 0)
+            return 1;
+        const pid_t child = fork();
+        if (child < 0)
+            return 1;
+        if (child == 0)
+        {
+            close(ends[0]);
+            int status = 0;
+            try
+            {
+                // Every mode's weights, sent once all of them are done so no
+                // rank blocks on the pipe while the others need it in the ring
+                std::vector<char> all;
+                size_t mode = 0;
+                for (bool sparse : { false, true })
+                    for (size_t threads : { 1, 3 })
+                    {
+                        const auto bytes = train(prefix + std::to_string(mode++), rank, sparse, threads);
+                        all.insert(all.end(), bytes.begin(), bytes.end());
+                    }
+                for (size_t written = 0; written < all.size();)
+                {
+                    const ssize_t result = write(ends[1], all.data() + written, all.size() - written);
+                    if (result <= 0)
+                        break;
+                    written += (size_t)result;
+                }
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "rank " << rank << ": " << e.what() << '\n';
+                status = 1;
+            }
+            close(ends[1]);
+            _exit(status);
+        }
+        close(ends[1]);
+        children.push_back(child);
+        pipes.push_back(ends[0]);
+    }
+
+    std::vector<std::vector<char>> results(RANKS);
+    for (size_t rank = 0; rank < RANKS; ++rank)
+    {
+        char buffer[4096];
+        ssize_t result;
+        while ((result = read(pipes[rank], buffer, sizeof(buffer))) > 0)
+            results[rank].insert(results[rank].end(), buffer, buffer + result);
+        close(pipes[rank]);
+    }
+    size_t failures = 0;
+    for (size_t rank = 0; rank < RANKS; ++rank)
+    {
+        int status = 0;
+        waitpid(children[rank], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::cerr << "rank " << rank << " failed\n";
+            ++failures;
+        }
+    }
+    for (size_t rank = 1; rank < RANKS; ++rank)
+    {
+        if (results[rank].empty() || results[rank] != results[0])
+        {
+            std::cerr << "rank " << rank << " has other weights than rank 0\n";
+            ++failures;
+        }
+    }
+    return failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+// Saves a StaticNetwork in the NeuralNetwork format and loads it back both as
+// a StaticNetwork and as a NeuralNetwork. Each has to give the same outputs
+// bit for bit as the network of its kind it was saved from.
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "static_network.h"
+#include "random.h"
+
+using XorNetwork = StaticNetwork<2, Dense<3, Tanh>, Dense<1, Linear>>;
+
+int main()
+{
+    NeuralNetwork net;
+    net.add(2);
+    net.add<Tanh>(3);
+    net.add<Linear>(1);
+    net.initWeights();
+    net.setOptimizer<Gd>();
+    for (auto& bias : net.layers[1].biases)
+        bias = (Scalar)Random::Float();
+
+    const XorNetwork original(net);
+    std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+    original.save(stream);
+    const std::string saved = stream.str();
+
+    std::istringstream static_stream(saved, std::ios::binary);
+    XorNetwork loaded = XorNetwork::load(static_stream);
+    NeuralNetwork dynamic;
+    std::istringstream dynamic_stream(saved, std::ios::binary);
+    dynamic_stream >> dynamic;
+
+    XorNetwork reference = original;
+    size_t failures = 0;
+    for (int sample = 0; sample < 16; ++sample)
+    {
+        const XorNetwork::Inputs inputs = { (Scalar)Random::Float(), (Scalar)Random::Float() };
+        const std::vector<Scalar> sample_inputs(inputs.begin(), inputs.end());
+        const Scalar expected_static = reference.forward(inputs)[0];
+        const Scalar from_static = loaded.forward(inputs)[0];
+        net.forward(sample_inputs);
+        const Scalar expected_dynamic = net.getOutput()[0];
+        dynamic.forward(sample_inputs);
+        const Scalar from_dynamic = dynamic.getOutput()[0];
+        if (from_static != expected_static || from_dynamic != expected_dynamic)
+        {
+            std::cerr << "sample " << sample << ": " << from_static << " != " << expected_static << " or "
+                      << from_dynamic << " != " << expected_dynamic << '\n';
+            ++failures;
+        }
+    }
+    return failures ? 1 : 0;
+}
\ No newline at end of file